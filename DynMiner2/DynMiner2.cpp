@@ -9,6 +9,10 @@
 #include "cGetWork.h"
 #include "cMiner.h"
 #include "cSubmitter.h"
+#include "cHashBlock.h"
+#include "cTopology.h"
+#include "cNonceAudit.h"
+#include "memgen_rows.h"
 #include <CL/cl.h>
 #include <CL/cl_platform.h>
 
@@ -36,6 +40,17 @@ using namespace std;
 string minerMode;       //solo or stratum
 string statURL;
 string minerName;
+string sha256Backend;   //forced SHA-256 backend, empty to autodetect
+string memgenBackend;   //capped memgen row kernels, empty to autodetect
+string cpuEngine = "threaded";
+string optimizeMode = "on";     //hash program optimizer - on, off or verify
+string hugePages = "on";        //hash block pages - on (transparent huge pages for a zero block), hugetlb or off
+string sharedBlock;            //name of a hash block shared with other miner processes, empty for a private one
+string numaMode = "off";        //CPU thread pinning and hash block placement - off, pin, interleave or replicate
+string nonceAudit = "off";      //track the nonce ranges every miner hashed and report duplicates and gaps
+string tuneMode = "off";        //tune every GPU miner on the benchmark job before it starts
+string gpuProfile = "gpu_profile.json";     //tuned GPU settings, read by GPU,auto miners
+uint32_t gpuBatchMs = 0;        //kernel time GPU batches are resized toward, 0 keeps the configured or tuned work items
 int stratumSocket;      //tcp connected socket for stratum mode
 int socketError;        //global var to detect socket errors
 
@@ -44,6 +59,8 @@ multimap<string, string> commandArgs;
 cStatDisplay* statDisplay;
 cGetWork* getWork;
 cSubmitter* submitter;
+cTopology topology;
+cNonceAudit* audit;
 
 unsigned char* hashBlock;
 
@@ -108,7 +125,8 @@ void showUsage(const char* message) {
 
     printf("USAGE\n");
     printf("dynminer \n");
-    printf("  -mode [solo|stratum|pool]\n");
+    printf("  -mode [solo|stratum|pool|benchmark]\n");
+    printf("        benchmark mines a built in job offline, only -miner is required\n");
     printf("  -server <rpc server URL or stratum/pool IP>\n");
     printf("  -port <rpc port>  [only used for stratum and pool]\n");
     printf("  -user <username>\n");
@@ -118,11 +136,24 @@ void showUsage(const char* message) {
     printf("  -hiveos [0|1]   [optional, if 1 will format output for hiveos]\n");
     printf("  -statrpcurl <URL to send stats to> [optional]\n");
     printf("  -minername <display name of miner> [required with statrpcurl]\n");
+    printf("  -cpuengine [jit|threaded|pipelined|legacy]   [optional, engine for CPU miners with 1 lane, pipelined keeps 4 nonces in flight per thread to hide SUMBLOCK reads, default threaded]\n");
+    printf("  -sha256 [standard|sse41|avx2|shani]   [optional, caps the CPU SHA-256 backend, default is the best the CPU supports]\n");
+    printf("  -memgen [standard|avx2|avx512]   [optional, caps the CPU memgen row kernels, default is the best the CPU supports]\n");
+    printf("  -optimize [on|off|verify]   [optional, hash program optimizer, verify checks each optimized program on random headers, default on]\n");
+    printf("  -hugepages [on|hugetlb|off]   [optional, on backs the 3GB hash block with transparent huge pages, which map the huge zero page and cost no RAM.  hugetlb uses reserved 1GB/2MB hugetlbfs pages or Windows large pages - fewer TLB misses, but every page read is real RAM, up to 3GB.  Default on]\n");
+    printf("  -sharedblock <name>   [optional, share the hash block with other miner processes - a shm name like /dynminer or a file on /dev/shm or a hugetlbfs mount.  Only with -hugepages hugetlb while the block is all zeros: the rows read are then real RAM once for all processes instead of in each, with transparent huge pages a private block maps the zero page and costs nothing]\n");
+    printf("  -numa [off|pin|interleave|replicate]   [optional, pin CPU miner threads to cores spread over the NUMA nodes, interleave the hash block over the nodes or give each node its own copy, default off]\n");
+    printf("  -nonceaudit [on|off]   [optional, record the nonces every miner hashed and report duplicated and skipped ones and the unique hashrate, default off]\n");
+    printf("  -tune [on|off]   [optional, find the best work items, work size and loops of each GPU on the benchmark job and save them to the GPU profile, default off]\n");
+    printf("  -gpuprofile <file>   [optional, tuned GPU settings per device name and driver version, default gpu_profile.json]\n");
+    printf("  -gpubatchms <ms>   [optional, resize GPU batches while mining so each kernel runs about this long (50 to 200 is typical), up to twice the configured or tuned work items, which doubles the memgen buffer, default 0 - batches keep their size]\n");
     printf("\n");
     printf("<miner params> format:\n");
     printf("  [CPU|GPU],<cores or compute units>[<work size>,<platform id>,<device id>[,<loops>]]\n");
     printf("  <work size>, <platform id> and <device id> are not required for CPU\n");
-    printf("  <loops> is an optional GPU tuning param - default is 1, optimal range can be 2 to 10 for high end cards");
+    printf("  CPU,<cores>[,<lanes>] - <lanes> is the number of nonces each CPU thread hashes in lockstep (1, 4, 8 or 16, default 8)\n");
+    printf("  <loops> is an optional GPU tuning param - default is 1, optimal range can be 2 to 10 for high end cards\n");
+    printf("  GPU,auto,<platform id>,<device id> - settings from the GPU profile, the card is tuned first when it has no entry\n");
     printf("  multiple miner params are allowed\n");
     printf("\n");
     printf("Example:\n");
@@ -152,7 +183,7 @@ void parseCommandArgs(int argc, char* argv[]) {
         multimap<string, string>::iterator it = commandArgs.find("-mode");
         string mode = it->second;
         transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
-        set<string> modeTypes = { "solo", "stratum", "pool"};
+        set<string> modeTypes = { "solo", "stratum", "pool", "benchmark" };
         if (modeTypes.find(mode) == modeTypes.end())
             showUsage("Invalid MODE argument");
         minerMode = mode;
@@ -173,10 +204,12 @@ void parseCommandArgs(int argc, char* argv[]) {
     }
 
 
-    if (commandArgs.find("-server") == commandArgs.end())
-        showUsage("Missing argument: server");
-    else
-        rpcConfigParams.server = commandArgs.find("-server")->second;
+    if (minerMode != "benchmark") {
+        if (commandArgs.find("-server") == commandArgs.end())
+            showUsage("Missing argument: server");
+        else
+            rpcConfigParams.server = commandArgs.find("-server")->second;
+    }
 
     if ((minerMode == "stratum") || (minerMode == "pool")) {
         if (commandArgs.find("-port") == commandArgs.end())
@@ -185,12 +218,14 @@ void parseCommandArgs(int argc, char* argv[]) {
             rpcConfigParams.port = commandArgs.find("-port")->second;
     }
 
-    if (commandArgs.find("-user") == commandArgs.end())
-        showUsage("Missing argument: user");
-    else
-        rpcConfigParams.user = commandArgs.find("-user")->second;
+    if (minerMode != "benchmark") {
+        if (commandArgs.find("-user") == commandArgs.end())
+            showUsage("Missing argument: user");
+        else
+            rpcConfigParams.user = commandArgs.find("-user")->second;
+    }
 
-    if (minerMode != "pool") {
+    if ((minerMode != "pool") && (minerMode != "benchmark")) {
         if (commandArgs.find("-pass") == commandArgs.end())
             showUsage("Missing argument: pass");
         else
@@ -198,7 +233,7 @@ void parseCommandArgs(int argc, char* argv[]) {
     }
 
 
-    if ((minerMode != "stratum") && (minerMode != "pool")) {
+    if ((minerMode != "stratum") && (minerMode != "pool") && (minerMode != "benchmark")) {
         if (commandArgs.find("-wallet") == commandArgs.end())
             showUsage("Missing argument: wallet");
         else
@@ -209,6 +244,91 @@ void parseCommandArgs(int argc, char* argv[]) {
         showUsage("Missing argument: miner");
 
 
+    if (commandArgs.find("-cpuengine") != commandArgs.end()) {
+        string engine = commandArgs.find("-cpuengine")->second;
+        transform(engine.begin(), engine.end(), engine.begin(), ::tolower);
+        set<string> engineTypes = { "jit", "threaded", "pipelined", "legacy" };
+        if (engineTypes.find(engine) == engineTypes.end())
+            showUsage("Invalid CPUENGINE argument");
+        cpuEngine = engine;
+    }
+
+    if (commandArgs.find("-sha256") != commandArgs.end()) {
+        string backend = commandArgs.find("-sha256")->second;
+        transform(backend.begin(), backend.end(), backend.begin(), ::tolower);
+        set<string> backendTypes = { "standard", "sse41", "avx2", "shani" };
+        if (backendTypes.find(backend) == backendTypes.end())
+            showUsage("Invalid SHA256 argument");
+        sha256Backend = backend;
+    }
+
+    if (commandArgs.find("-memgen") != commandArgs.end()) {
+        string backend = commandArgs.find("-memgen")->second;
+        transform(backend.begin(), backend.end(), backend.begin(), ::tolower);
+        set<string> backendTypes = { "standard", "avx2", "avx512" };
+        if (backendTypes.find(backend) == backendTypes.end())
+            showUsage("Invalid MEMGEN argument");
+        memgenBackend = backend;
+    }
+
+    if (commandArgs.find("-optimize") != commandArgs.end()) {
+        string mode = commandArgs.find("-optimize")->second;
+        transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
+        set<string> optimizeTypes = { "on", "off", "verify" };
+        if (optimizeTypes.find(mode) == optimizeTypes.end())
+            showUsage("Invalid OPTIMIZE argument");
+        optimizeMode = mode;
+    }
+
+    if (commandArgs.find("-hugepages") != commandArgs.end()) {
+        string pages = commandArgs.find("-hugepages")->second;
+        transform(pages.begin(), pages.end(), pages.begin(), ::tolower);
+        if ((pages != "on") && (pages != "hugetlb") && (pages != "off"))
+            showUsage("Invalid HUGEPAGES argument");
+        hugePages = pages;
+    }
+
+    if (commandArgs.find("-sharedblock") != commandArgs.end()) {
+        sharedBlock = commandArgs.find("-sharedblock")->second;
+        if (sharedBlock.empty() || (sharedBlock[0] != '/'))
+            showUsage("Invalid SHAREDBLOCK argument, it must start with /");
+    }
+
+    if (commandArgs.find("-numa") != commandArgs.end()) {
+        string mode = commandArgs.find("-numa")->second;
+        transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
+        set<string> numaTypes = { "off", "pin", "interleave", "replicate" };
+        if (numaTypes.find(mode) == numaTypes.end())
+            showUsage("Invalid NUMA argument");
+        numaMode = mode;
+    }
+
+    if (commandArgs.find("-nonceaudit") != commandArgs.end()) {
+        string mode = commandArgs.find("-nonceaudit")->second;
+        transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
+        if ((mode != "on") && (mode != "off"))
+            showUsage("Invalid NONCEAUDIT argument");
+        nonceAudit = mode;
+    }
+
+    if (commandArgs.find("-tune") != commandArgs.end()) {
+        string mode = commandArgs.find("-tune")->second;
+        transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
+        if ((mode != "on") && (mode != "off"))
+            showUsage("Invalid TUNE argument");
+        tuneMode = mode;
+    }
+
+    if (commandArgs.find("-gpuprofile") != commandArgs.end())
+        gpuProfile = commandArgs.find("-gpuprofile")->second;
+
+    if (commandArgs.find("-gpubatchms") != commandArgs.end()) {
+        string ms = commandArgs.find("-gpubatchms")->second;
+        if (ms.empty() || (ms.find_first_not_of("0123456789") != string::npos) || (atoi(ms.c_str()) > 10000))
+            showUsage("Invalid GPUBATCHMS argument");
+        gpuBatchMs = atoi(ms.c_str());
+    }
+
     if (commandArgs.find("-hiveos") != commandArgs.end()) {
         string num = commandArgs.find("-hiveos")->second;
         rpcConfigParams.hiveos = atoi(num.c_str());
@@ -228,7 +348,7 @@ void startSubmitter() {
     socketError = false;
     submitter->socketError = &socketError;
 
-    thread submitThread(&cSubmitter::submitEvalThread, submitter, getWork, statDisplay, minerMode);
+    thread submitThread(&cSubmitter::submitThread, submitter, getWork, statDisplay, minerMode);
     submitThread.detach();
 }
 
@@ -259,6 +379,13 @@ void startOneMiner(std::string params, uint32_t GPUIndex) {
     printf("Starting miner with params: %s\n", params.c_str());
 
     cMiner *miner = new cMiner();
+    miner->benchmark = (minerMode == "benchmark");
+    miner->cpuEngine = cpuEngine;
+    miner->topology = &topology;
+    miner->audit = audit;
+    miner->tune = (tuneMode == "on");
+    miner->gpuProfile = gpuProfile;
+    miner->batchTargetMs = gpuBatchMs;
     thread minerThread(&cMiner::startMiner, miner, params, getWork, submitter, statDisplay, GPUIndex, hashBlock);
     minerThread.detach();
 
@@ -266,6 +393,21 @@ void startOneMiner(std::string params, uint32_t GPUIndex) {
 }
 
 
+//every CPU mining thread, every GPU and the submit thread pin jobs
+int countJobReaders() {
+    int readers = 1;
+    pair<multimap<string, string>::iterator, multimap<string, string>::iterator> range = commandArgs.equal_range("-miner");
+    for (multimap<string, string>::iterator it = range.first; it != range.second; ++it) {
+        const string& params = it->second;
+        if ((params.size() > 0) && (tolower(params[0]) == 'c'))
+            readers += max(atoi(params.substr(params.find(',') + 1).c_str()), 0);
+        else
+            readers++;
+    }
+    return readers;
+}
+
+
 void startMiners() {
     miners.clear();
 
@@ -356,6 +498,19 @@ int main(int argc, char* argv[])
 
     parseCommandArgs(argc, argv);
 
+    string sha256Impl = SHA256AutoDetect(sha256Backend);
+    printf("SHA-256 implementation: %s\n", sha256Impl.c_str());
+    if (!sha256Backend.empty() && sha256Impl.find(sha256Backend) == string::npos)
+        printf("SHA-256 backend %s is not supported by this CPU, using %s\n", sha256Backend.c_str(), sha256Impl.c_str());
+    string memgenImpl = MemRowsAutoDetect(memgenBackend);
+    printf("Memgen row operations: %s\n", memgenImpl.c_str());
+    if (!memgenBackend.empty() && (memgenImpl != memgenBackend))
+        printf("Memgen row kernels %s are not supported by this CPU or build, using %s\n", memgenBackend.c_str(), memgenImpl.c_str());
+
+    //jobs are compiled by the network thread, so the jit has to be set up before it starts
+    cProgramJIT::enabled = (cpuEngine == "jit");
+    cProgramJIT::inlineShani = (sha256Impl.find("shani") == 0);
+
     if (minerMode == "stratum") {
         initWinsock();
         if (!connectToStratum())
@@ -370,20 +525,71 @@ int main(int argc, char* argv[])
         authorizePool();
     }
 
-    const uint64_t hashBlockSize = 1024ULL * 1024ULL * 3072ULL;
-    hashBlock = (unsigned char*)malloc(hashBlockSize);
+    //shared pages are real RAM, only once for all processes - worth it when a private block would
+    //be real RAM in every process too, not for a zero block on the zero page
+    bool shareBlock = !sharedBlock.empty() && ((hugePages == "hugetlb") || !cHashBlock::zeroed);
+    if (!sharedBlock.empty() && !shareBlock)
+        printf("Not sharing the hash block, it is all zeros and a private one on transparent huge pages uses almost no RAM - share it with -hugepages hugetlb\n");
+    if (shareBlock)
+        hashBlock = cHashBlock::attachShared(sharedBlock, HASHBLOCK_SIZE, NULL);     //all zeros, nothing to write
+    else
+        hashBlock = cHashBlock::allocate(HASHBLOCK_SIZE, hugePages);
     if (hashBlock == NULL) {
         printf("Unable to allocate 3GB hash block, aborting.\n");
         exit(0);
     }
 
-    memset(hashBlock, 0, hashBlockSize);
+    printf("Hash block on %s\n", cHashBlock::pageType.c_str());
+
+    //the block has not been touched yet, so the memory policy decides where its pages go
+    topology.mode = numaMode;
+    if (numaMode != "off") {
+        topology.discover();
+        printf("Topology: %d logical CPUs, %d physical cores, %d NUMA nodes\n", (int)topology.cpus.size(), topology.physicalCores, (int)topology.nodeIds.size());
+        if (topology.cpus.empty())
+            printf("CPU topology is not available, CPU miner threads are not pinned\n");
+    }
+    for (size_t n = 0; n < topology.nodeIds.size(); n++) {
+        unsigned char* block = hashBlock;
+        if ((numaMode == "replicate") && (n > 0)) {
+            block = cHashBlock::allocate(HASHBLOCK_SIZE, hugePages);
+            if (block == NULL) {
+                printf("Unable to allocate the hash block for NUMA node %d, aborting.\n", topology.nodeIds[n]);
+                exit(0);
+            }
+        }
+        if ((numaMode == "replicate") && !cHashBlock::bindToNode(block, HASHBLOCK_SIZE, topology.nodeIds[n]))
+            printf("Unable to bind the hash block to NUMA node %d\n", topology.nodeIds[n]);
+        topology.nodeBlocks.push_back(block);
+    }
+    if ((numaMode == "interleave") && !cHashBlock::interleave(hashBlock, HASHBLOCK_SIZE, topology.nodeIds))
+        printf("Unable to interleave the hash block over the NUMA nodes\n");
+
+    //SUMBLOCK cost with and without a TLB miss per read, to compare -hugepages modes
+    if (minerMode == "benchmark") {
+        double randomRows = cHashBlock::timeSumBlock(hugePages, 2000000, true);
+        double sameRow = cHashBlock::timeSumBlock(hugePages, 2000000, false);
+        printf("SUMBLOCK read: %.1f ns at random rows, %.1f ns at one row\n", randomRows, sameRow);
+    }
 
 
     statDisplay = new cStatDisplay();
+    statDisplay->sha256Impl = sha256Impl;
+    if (topology.nodeIds.size() > 1)
+        for (size_t n = 0; n < topology.nodeIds.size(); n++)
+            statDisplay->nodeStats.push_back(new cStats());
     getWork = new cGetWork();
+    getWork->optimizeMode = optimizeMode;
+    getWork->hashBlock = hashBlock;
+    getWork->allocJobReaders(countJobReaders());
     submitter = new cSubmitter();
 
+    audit = NULL;
+    if (nonceAudit == "on") {
+        audit = new cNonceAudit();
+        thread auditThread(&cNonceAudit::reportThread, audit, getWork, statDisplay);
+        auditThread.detach();
+    }
 
     startStatDisplay();
     startGetWork();
@@ -0,0 +1,24 @@
+#include "allocCount.h"
+#include <cstdlib>
+#include <new>
+
+//Global operator new/delete are replaced so allocations can be counted per thread.  Benchmark
+//mode uses this to check that the CPU hash loop never allocates.
+
+static thread_local uint64_t allocCount = 0;
+
+uint64_t threadAllocCount() {
+    return allocCount;
+}
+
+void* operator new(size_t size) {
+    allocCount++;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include <cstdint>
+
+//Number of heap allocations (operator new) made so far by the calling thread.
+uint64_t threadAllocCount();
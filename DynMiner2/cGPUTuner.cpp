@@ -0,0 +1,384 @@
+#include "cGPUTuner.h"
+#include "cMiner.h"
+#include "cGetWork.h"
+#include "cProgramVM.h"
+#include "cHashBlock.h"
+#include <stdio.h>
+#include <chrono>
+
+
+mutex cGPUTuner::profileLock;
+
+
+//the profile at path, an empty object when there is none.  valid is false for a file that is not a JSON object.
+static json readProfile(const string& path, bool& valid) {
+
+	valid = true;
+	FILE* f = fopen(path.c_str(), "r");
+	if (f == NULL)
+		return json::object();
+
+	string text;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		text.append(buf, n);
+	fclose(f);
+
+	json profile = json::parse(text, nullptr, false);
+	if (profile.is_discarded() || !profile.is_object()) {
+		valid = false;
+		return json::object();
+	}
+	return profile;
+}
+
+
+cGPUTuner::cGPUTuner(cMiner* miner, int platformID, int deviceID, unsigned char* hashBlock) {
+
+	this->miner = miner;
+	this->platformID = platformID;
+	this->deviceID = deviceID;
+	this->hashBlock = hashBlock;
+	job = NULL;
+	context = NULL;
+	commandQueue = NULL;
+	program = NULL;
+	kernel = NULL;
+	programLoops = 0;
+	programBuffer = NULL;
+	headerBuffer = NULL;
+	nonceBuffer = NULL;
+	abortBuffer = NULL;
+	hashBlockBuffer = NULL;
+	hashResultBuffer = NULL;
+	memgenBuffer = NULL;
+	allocated = 0;
+	maxItems = 0;
+	workSizeMultiple = 0;
+	maxWorkSize = 0;
+	nonce = 0;
+
+	cl_platform_id platforms[16];
+	cl_device_id devices[16];
+	cl_uint numPlatforms = 0;
+	cl_uint numDevices = 0;
+	clGetPlatformIDs(16, platforms, &numPlatforms);
+	if ((platformID < 0) || (platformID >= (int)numPlatforms) ||
+		(clGetDeviceIDs(platforms[platformID], CL_DEVICE_TYPE_GPU, 16, devices, &numDevices) != CL_SUCCESS) ||
+		(deviceID < 0) || (deviceID >= (int)numDevices)) {
+		printf("No OpenCL GPU at platform %d, device %d\n", platformID, deviceID);
+		exit(0);
+	}
+	device = devices[deviceID];
+}
+
+
+cGPUTuner::~cGPUTuner() {
+
+	cl_mem buffers[] = { programBuffer, headerBuffer, nonceBuffer, abortBuffer, hashBlockBuffer, hashResultBuffer, memgenBuffer };
+	for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++)
+		if (buffers[i] != NULL)
+			clReleaseMemObject(buffers[i]);
+	if (kernel != NULL)
+		clReleaseKernel(kernel);
+	if (program != NULL)
+		clReleaseProgram(program);
+	if (commandQueue != NULL)
+		clReleaseCommandQueue(commandQueue);
+	if (context != NULL)
+		clReleaseContext(context);
+}
+
+
+string cGPUTuner::deviceKey() {
+
+	char name[256] = {};
+	char driver[256] = {};
+	clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name) - 1, name, NULL);
+	clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver) - 1, driver, NULL);
+	return string(name) + " | " + driver;
+}
+
+
+size_t cGPUTuner::roundUp(size_t computeUnits, size_t workSize) {
+	return (computeUnits + workSize - 1) / workSize * workSize;
+}
+
+
+//program and kernel for loops, false when the program does not build with it
+bool cGPUTuner::build(int loops) {
+
+	if (programLoops == loops)
+		return true;
+
+	if (kernel != NULL)
+		clReleaseKernel(kernel);
+	if (program != NULL)
+		clReleaseProgram(program);
+	kernel = NULL;
+	programLoops = 0;
+
+	program = miner->loadMiner(context, &device, loops, false);
+	if (program == NULL)
+		return false;
+
+	cl_int returnVal;
+	kernel = clCreateKernel(program, "dyn_hash", &returnVal);
+	if (returnVal != CL_SUCCESS)
+		return false;
+
+	if ((clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &workSizeMultiple, NULL) != CL_SUCCESS) || (workSizeMultiple == 0))
+		workSizeMultiple = 64;
+	if ((clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkSize, NULL) != CL_SUCCESS) || (maxWorkSize < workSizeMultiple))
+		maxWorkSize = workSizeMultiple;
+
+	programLoops = loops;
+	return true;
+}
+
+
+//memgen and hash result buffers for computeUnits work items, kept when they are big enough
+bool cGPUTuner::allocate(size_t computeUnits) {
+
+	if (computeUnits <= allocated)
+		return true;
+
+	if (memgenBuffer != NULL)
+		clReleaseMemObject(memgenBuffer);
+	if (hashResultBuffer != NULL)
+		clReleaseMemObject(hashResultBuffer);
+	allocated = 0;
+
+	cl_int memgenVal, hashVal;
+	memgenBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, TUNE_MEMGEN_ITEM * computeUnits, NULL, &memgenVal);
+	hashResultBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, 32 * computeUnits, NULL, &hashVal);
+	if ((memgenVal != CL_SUCCESS) || (hashVal != CL_SUCCESS))
+		return false;
+
+	allocated = computeUnits;
+	return true;
+}
+
+
+//hash the benchmark job with config for about TUNE_MEASURE_MS, false when it cannot run
+bool cGPUTuner::measure(cGPUConfig& config) {
+
+	config.hashrate = 0;
+	if (!build(config.loops) || !allocate(config.computeUnits) || (config.workSize > maxWorkSize))
+		return false;
+
+	uint64_t target = job->target;
+	bool ok = (clSetKernelArg(kernel, 0, sizeof(cl_mem), &programBuffer) == CL_SUCCESS) &&
+		(clSetKernelArg(kernel, 1, sizeof(cl_mem), &hashResultBuffer) == CL_SUCCESS) &&
+		(clSetKernelArg(kernel, 2, sizeof(cl_mem), &headerBuffer) == CL_SUCCESS) &&
+		(clSetKernelArg(kernel, 3, sizeof(cl_mem), &nonceBuffer) == CL_SUCCESS) &&
+		(clSetKernelArg(kernel, 4, sizeof(cl_ulong), &target) == CL_SUCCESS) &&
+		(clSetKernelArg(kernel, 5, sizeof(cl_mem), &memgenBuffer) == CL_SUCCESS) &&
+		(clSetKernelArg(kernel, 6, sizeof(cl_mem), &hashBlockBuffer) == CL_SUCCESS) &&
+		(clSetKernelArg(kernel, 7, sizeof(cl_mem), &abortBuffer) == CL_SUCCESS);
+	if (!ok)
+		return false;
+
+	//one batch to warm up and size the measurement, then as many as fit in TUNE_MEASURE_MS
+	uint32_t batchSize = config.computeUnits * config.loops;
+	int batches = 1;
+	double seconds = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int b = 0; b < batches; b++) {
+			size_t offset = nonce;
+			if (clEnqueueNDRangeKernel(commandQueue, kernel, 1, &offset, &config.computeUnits, &config.workSize, 0, NULL, NULL) != CL_SUCCESS)
+				return false;
+			nonce += batchSize;
+		}
+		if (clFinish(commandQueue) != CL_SUCCESS)
+			return false;
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		double ms = max(seconds * 1000, 0.001);
+		batches = max(1, min(1000, (int)(TUNE_MEASURE_MS / ms)));
+	}
+
+	config.hashrate = (double)batchSize * batches / seconds;
+	printf("Tuning %02d:%02d.0: %zu work items, work size %zu, %d loops - %.2f KH/s\n",
+		platformID, deviceID, config.computeUnits, config.workSize, config.loops, config.hashrate / 1024);
+	return true;
+}
+
+
+cGPUConfig cGPUTuner::tune(const string& optimizeMode) {
+
+	cGPUConfig best;
+
+	//the bundled benchmark job, the same workload -mode benchmark mines.  Not compiled for the
+	//jit, the GPU does not use it and cProgramJIT::compile belongs to the network thread.
+	cGetWork bench;
+	bench.compileJIT = false;
+	bench.programVM = new cProgramVM();
+	bench.miningMode = "benchmark";
+	bench.optimizeMode = optimizeMode;
+	bench.hashBlock = hashBlock;
+	bench.loadBenchmarkJob();
+	bench.prepareJob();
+	job = bench.currentJob;
+
+	cl_int returnVal;
+	context = clCreateContext(NULL, 1, &device, NULL, NULL, &returnVal);
+	commandQueue = clCreateCommandQueueWithProperties(context, device, NULL, &returnVal);
+
+	cl_uint deviceCUs = 1;
+	cl_ulong maxMemAlloc = 0;
+	cl_ulong globalMem = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(deviceCUs), &deviceCUs, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxMemAlloc), &maxMemAlloc, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, NULL);
+
+	//the memgen buffer is one allocation, and it shares the card with the hash block
+	size_t hashBlockSize = 1024ULL * 1024ULL * 3072ULL;
+	maxItems = maxMemAlloc / TUNE_MEMGEN_ITEM;
+	if (globalMem > hashBlockSize)
+		maxItems = min(maxItems, (size_t)((globalMem - hashBlockSize) / 10 * 9 / (TUNE_MEMGEN_ITEM + 32)));
+	else
+		maxItems = 0;
+
+	unsigned char header[80 + 32 + 32];
+	memcpy(header, job->header, 80);
+	memcpy(header + 80, job->midstate, 32);
+	memcpy(header + 112, job->prevHashSHA, 32);
+
+	cl_int programVal, headerVal, nonceVal, abortVal, blockVal;
+	programBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, 8192, NULL, &programVal);
+	headerBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(header), NULL, &headerVal);
+	nonceBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * 0x101, NULL, &nonceVal);
+	abortBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_uint), NULL, &abortVal);
+	hashBlockBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, hashBlockSize, NULL, &blockVal);
+
+	cl_uint zeroPattern = 0;
+	bool ready = (programVal == CL_SUCCESS) && (headerVal == CL_SUCCESS) && (nonceVal == CL_SUCCESS) && (abortVal == CL_SUCCESS) && (blockVal == CL_SUCCESS) &&
+		(clEnqueueWriteBuffer(commandQueue, programBuffer, CL_TRUE, 0, job->byteCode.size() * 4, job->byteCode.data(), 0, NULL, NULL) == CL_SUCCESS) &&
+		(clEnqueueWriteBuffer(commandQueue, headerBuffer, CL_TRUE, 0, sizeof(header), header, 0, NULL, NULL) == CL_SUCCESS) &&
+		(clEnqueueWriteBuffer(commandQueue, nonceBuffer, CL_TRUE, 0, sizeof(cl_uint), &zeroPattern, 0, NULL, NULL) == CL_SUCCESS) &&
+		(clEnqueueWriteBuffer(commandQueue, abortBuffer, CL_TRUE, 0, sizeof(cl_uint), &zeroPattern, 0, NULL, NULL) == CL_SUCCESS);
+	if (ready && (!cHashBlock::zeroed || (clEnqueueFillBuffer(commandQueue, hashBlockBuffer, &zeroPattern, sizeof(zeroPattern), 0, hashBlockSize, 0, NULL, NULL) != CL_SUCCESS)))
+		ready = (clEnqueueWriteBuffer(commandQueue, hashBlockBuffer, CL_TRUE, 0, hashBlockSize, hashBlock, 0, NULL, NULL) == CL_SUCCESS);
+
+	if (!ready || !build(1)) {
+		printf("Unable to tune platform %d, device %d\n", platformID, deviceID);
+		delete bench.programVM;
+		delete bench.currentJob.load();
+		return best;
+	}
+
+	printf("Tuning platform %d, device %d: %s, %u compute units, work size multiple %zu, at most %zu work items\n",
+		platformID, deviceID, deviceKey().c_str(), deviceCUs, workSizeMultiple, maxItems);
+
+	//global size - a work group per compute unit, doubled until the card is saturated
+	size_t workSize = workSizeMultiple;
+	best = cGPUConfig(roundUp(deviceCUs * workSize, workSize), workSize, 1);
+	if ((best.computeUnits > maxItems) || !measure(best)) {
+		best = cGPUConfig(workSize, workSize, 1);
+		measure(best);
+	}
+	while (best.computeUnits * 2 <= maxItems) {
+		cGPUConfig next(best.computeUnits * 2, workSize, 1);
+		if (!measure(next) || (next.hashrate <= best.hashrate))
+			break;
+		bool plateau = (next.hashrate < best.hashrate * (1 + TUNE_PLATEAU));
+		best = next;
+		if (plateau)
+			break;
+	}
+
+	//local size - multiples of the preferred multiple, the global size kept a multiple of it
+	for (workSize = workSizeMultiple * 2; workSize <= maxWorkSize; workSize *= 2) {
+		cGPUConfig next(roundUp(best.computeUnits, workSize), workSize, 1);
+		if ((next.computeUnits > maxItems) || !measure(next) || (next.hashrate <= best.hashrate))
+			break;
+		bool plateau = (next.hashrate < best.hashrate * (1 + TUNE_PLATEAU));
+		best = next;
+		if (plateau)
+			break;
+	}
+
+	//loops - each one is a rebuild, stop at the first that does not build
+	for (int loops = 2; loops <= TUNE_MAX_LOOPS; loops *= 2) {
+		cGPUConfig next(best.computeUnits, best.workSize, loops);
+		if (!measure(next) || (next.hashrate <= best.hashrate))
+			break;
+		bool plateau = (next.hashrate < best.hashrate * (1 + TUNE_PLATEAU));
+		best = next;
+		if (plateau)
+			break;
+	}
+
+	//more loops per item can move the best global size either way
+	cGPUConfig fewer(roundUp(best.computeUnits / 2, best.workSize), best.workSize, best.loops);
+	cGPUConfig more(best.computeUnits * 2, best.workSize, best.loops);
+	if ((fewer.computeUnits < best.computeUnits) && measure(fewer) && (fewer.hashrate > best.hashrate * (1 + TUNE_PLATEAU)))
+		best = fewer;
+	else if ((more.computeUnits <= maxItems) && measure(more) && (more.hashrate > best.hashrate * (1 + TUNE_PLATEAU)))
+		best = more;
+
+	printf("Tuned platform %d, device %d: GPU,%zu,%zu,%d,%d,%d - %.2f KH/s\n",
+		platformID, deviceID, best.computeUnits, best.workSize, platformID, deviceID, best.loops, best.hashrate / 1024);
+
+	delete bench.programVM;
+	delete bench.currentJob.load();
+	return best;
+}
+
+
+//the profile entry for key, false when there is none
+bool cGPUTuner::lookup(const string& path, const string& key, cGPUConfig& config) {
+
+	lock_guard<mutex> lock(profileLock);
+
+	bool valid;
+	json profile = readProfile(path, valid);
+	if (!valid)
+		printf("Ignoring GPU profile %s, it is not a JSON object\n", path.c_str());
+	if (!profile.contains(key))
+		return false;
+
+	const json& entry = profile[key];
+	config.computeUnits = entry.value("computeUnits", (size_t)0);
+	config.workSize = entry.value("workSize", (size_t)0);
+	config.loops = entry.value("loops", 1);
+	config.hashrate = entry.value("hashrate", 0.0);
+	return (config.computeUnits > 0) && (config.workSize > 0) && (config.loops > 0);
+}
+
+
+//add or replace the entry for key, other devices' entries are kept
+void cGPUTuner::save(const string& path, const string& key, const cGPUConfig& config) {
+
+	lock_guard<mutex> lock(profileLock);
+
+	bool valid;
+	json profile = readProfile(path, valid);
+	if (!valid)
+		printf("Replacing GPU profile %s, it is not a JSON object\n", path.c_str());
+
+	profile[key] = { {"computeUnits", config.computeUnits}, {"workSize", config.workSize}, {"loops", config.loops}, {"hashrate", config.hashrate} };
+
+	//written next to the profile and renamed over it, a crash never leaves half a file
+	string temp = path + ".tmp";
+	FILE* f = fopen(temp.c_str(), "w");
+	if (f == NULL) {
+		printf("Unable to write GPU profile %s\n", path.c_str());
+		return;
+	}
+	string text = profile.dump(4) + "\n";
+	bool written = (fwrite(text.data(), 1, text.size(), f) == text.size());
+	written = (fclose(f) == 0) && written;
+#ifdef _WIN32
+	remove(path.c_str());		//rename does not replace a file on Windows
+#endif
+	if (!written || (rename(temp.c_str(), path.c_str()) != 0)) {
+		printf("Unable to write GPU profile %s\n", path.c_str());
+		remove(temp.c_str());
+		return;
+	}
+	printf("Saved GPU profile for %s to %s\n", key.c_str(), path.c_str());
+}
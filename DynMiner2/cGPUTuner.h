@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <mutex>
+#include <CL/cl.h>
+#include <CL/cl_platform.h>
+
+class cMiner;
+class cPreparedJob;
+
+using namespace std;
+
+#define TUNE_MEASURE_MS 500			//each config hashes the benchmark job about this long
+#define TUNE_PLATEAU 0.03			//a step that gains less than this ends a sweep
+#define TUNE_MAX_LOOPS 16
+#define TUNE_MEMGEN_ITEM (512 * 8 * sizeof(uint32_t))		//memgen buffer each work item needs
+
+//A GPU miner setting, the -miner GPU,<computeUnits>,<workSize>,<platform>,<device>,<loops> values
+class cGPUConfig
+{
+public:
+	cGPUConfig() : computeUnits(0), workSize(0), loops(1), hashrate(0) {}
+	cGPUConfig(size_t computeUnits, size_t workSize, int loops) : computeUnits(computeUnits), workSize(workSize), loops(loops), hashrate(0) {}
+
+	size_t computeUnits;		//global size
+	size_t workSize;			//local size
+	int loops;					//GPU_LOOPS
+	double hashrate;			//measured on the benchmark job, 0 when not measured
+};
+
+//-tune and GPU,auto: finds the global size, local size and GPU_LOOPS that hash the benchmark
+//job fastest on one device.  Each sweep doubles one value until the gain drops under
+//TUNE_PLATEAU.  The results are kept in a JSON profile keyed by device name and driver
+//version, so every card of a SKU shares one entry and a driver update tunes again.
+class cGPUTuner
+{
+public:
+	cGPUTuner(cMiner* miner, int platformID, int deviceID, unsigned char* hashBlock);
+	~cGPUTuner();
+
+	cGPUConfig tune(const string& optimizeMode);
+
+	//"<device name> | <driver version>"
+	string deviceKey();
+
+	static bool lookup(const string& path, const string& key, cGPUConfig& config);
+	static void save(const string& path, const string& key, const cGPUConfig& config);
+
+	static mutex profileLock;
+
+private:
+	bool measure(cGPUConfig& config);
+	bool build(int loops);
+	bool allocate(size_t computeUnits);
+	size_t roundUp(size_t computeUnits, size_t workSize);
+
+	cMiner* miner;
+	int platformID;
+	int deviceID;
+	unsigned char* hashBlock;
+	const cPreparedJob* job;
+
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue commandQueue;
+	cl_program program;
+	cl_kernel kernel;
+	int programLoops;			//GPU_LOOPS program is built with, 0 for none
+
+	cl_mem programBuffer;
+	cl_mem headerBuffer;
+	cl_mem nonceBuffer;
+	cl_mem abortBuffer;			//never set, the tuner does not switch jobs
+	cl_mem hashBlockBuffer;
+	cl_mem hashResultBuffer;	//sized for allocated work items, like the memgen buffer
+	cl_mem memgenBuffer;
+	size_t allocated;
+
+	size_t maxItems;			//work items the memgen buffer can be allocated for
+	size_t workSizeMultiple;	//CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+	size_t maxWorkSize;			//CL_KERNEL_WORK_GROUP_SIZE
+	uint32_t nonce;
+};
@@ -1,11 +1,14 @@
 #include "cGetWork.h"
 #include "cProgramVM.h"
+#include "cProgramOptimizer.h"
 #include "cStatDisplay.h"
+#include "difficulty.h"
 
 //#define DEBUG_HIVE
 
 cGetWork::cGetWork() {
 	workID = 0;
+	compileJIT = true;
 }
 
 
@@ -43,6 +46,92 @@ void cGetWork::getWork(string mode, int stratumSocket, cStatDisplay* statDisplay
         startSoloGetWork(statDisplay);
     else if (mode == "pool")
         startPoolGetWork(stratumSocket, statDisplay);
+    else if (mode == "benchmark")
+        startBenchmarkGetWork(statDisplay);
+}
+
+
+//representative hash program for benchmark mode, same shape as the ones served by the chain
+static const char* benchmarkProgram =
+    "ADD 9e2f6cb7bd55e3bbb0a3f7a5a6b0ac3d2a4c4ad8e4f39f3f5a1e92b4d50e7d3c$"
+    "XOR 5be6c2f4a9d81e7c3b0f6a2d8e4c1b7a9f3d5e2c8b4a6f1d7e3c9b5a2f8d4e6c$"
+    "SHA2 4$"
+    "MEMGEN SHA2 512$"
+    "MEMADD 3c1e5a7f9b2d4c6e8a0f1b3d5c7e9a2b4d6f8a1c3e5b7d9f0a2c4e6b8d1f3a5c$"
+    "MEMXORHASHPREV$"
+    "READMEM2 XOR HASHPREV$"
+    "STORETEMP$"
+    "LOOP 4$"
+    "SHA2 2$"
+    "IF 3$"
+    "SHA2 3$"
+    "EXECOP TEMP$"
+    "READMEM2 ADD HASHPREV$"
+    "ENDLOOP$"
+    "SUMBLOCK$"
+    "SHA2";
+
+
+//The fixed synthetic job benchmark mode mines, also the workload the GPU tuner measures.
+//Leaves the header and program in nativeData and programVM, prepareJob publishes it.
+void cGetWork::loadBenchmarkJob() {
+
+    transactionString = NULL;
+    jobID = "benchmark";
+    timeHex = "00000000";
+
+    memset(nativeData, 0, 80);
+    nativeData[0] = 0x40;
+    for (int i = 4; i < 68; i++)
+        nativeData[i] = (unsigned char)(i * 37 + 11);
+    nativeData[72] = 0xff;
+    nativeData[73] = 0xff;
+    nativeData[74] = 0x0f;
+    nativeData[75] = 0x1e;
+
+    memcpy(prevBlockHashBin, nativeData + 4, 32);
+    memcpy(merkleRoot, nativeData + 36, 32);
+
+    strProgram = benchmarkProgram;
+    stringstream stream(strProgram);
+    string line;
+    vector<string> program{};
+    while (getline(stream, line, '$')) {
+        program.push_back(line);
+    }
+    program.push_back("ENDPROGRAM");
+
+    programVM->byteCode.clear();
+    programVM->generateBytecode(program, merkleRoot, prevBlockHashBin);
+}
+
+
+//Benchmark mode - no pool or node.  Mines the benchmark job, republished every 30 seconds
+//with a new ntime so job switches are exercised too.  The target is 0 so nothing is submitted.
+void cGetWork::startBenchmarkGetWork(cStatDisplay* statDisplay) {
+
+    loadBenchmarkJob();
+
+    printf("Benchmark mode, hash program is %d words\n", (int)programVM->byteCode.size());
+    vector<uint32_t> byteCode = jobByteCode();
+    if (optimizeMode != "off")
+        printf("Optimized hash program is %d words\n", (int)byteCode.size());
+    if (cProgramJIT::enabled) {
+        shared_ptr<cProgramJIT> jitProgram = cProgramJIT::compile(byteCode);
+        if (jitProgram)
+            printf("Hash program compiled to %d bytes of native code\n", (int)jitProgram->codeSize);
+        else
+            printf("Hash program cannot be compiled, using the threaded interpreter\n");
+    }
+
+    uint32_t ntime = 0;
+    while (true) {
+        memcpy(nativeData + 68, &ntime, 4);
+        prepareJob();
+        ntime++;
+
+        std::this_thread::sleep_for(std::chrono::seconds(30));
+    }
 }
 
 void cGetWork::startSoloGetWork( cStatDisplay* statDisplay) {
@@ -172,8 +261,6 @@ void cGetWork::startStratumGetWork(int stratumSocket, cStatDisplay* statDisplay)
 
 void cGetWork::setJobDetailsStratum(json msg) {
 
-	lockJob.lock();
-
 	const std::vector<json>& params = msg["params"];
 
 	jobID = params[0];         
@@ -249,9 +336,7 @@ void cGetWork::setJobDetailsStratum(json msg) {
     else
         programStartTime = 2;
 
-	workID++;
-
-	lockJob.unlock();
+	prepareJob();
 }
 
 
@@ -461,9 +546,6 @@ static unsigned int countLeadingZeros(unsigned char* hash) {
 
 void cGetWork::setJobDetailsSolo(json result, uint32_t extranonce, string coinbaseAddress) {
 
-
-    lockJob.lock();
-
     chainHeight = result["result"]["height"];
     uint32_t version = result["result"]["version"];
     string prevBlockHash = result["result"]["previousblockhash"];
@@ -601,8 +683,7 @@ void cGetWork::setJobDetailsSolo(json result, uint32_t extranonce, string coinba
         if (n % 2)
             memcpy(wtree[n], wtree[n - 1], 32);
         n = (n + 1) / 2;
-        for (int i = 0; i < n; i++)
-            sha256d(wtree[i], wtree[2 * i], 64);
+        SHA256D64(wtree[0], wtree[0], n);
     }
 
 
@@ -658,8 +739,7 @@ void cGetWork::setJobDetailsSolo(json result, uint32_t extranonce, string coinba
             ++n;
         }
         n /= 2;
-        for (int i = 0; i < n; i++)
-            sha256d(merkle_tree[i], merkle_tree[2 * i], 64);
+        SHA256D64(merkle_tree[0], merkle_tree[0], n);
     }
 
 
@@ -752,11 +832,163 @@ void cGetWork::setJobDetailsSolo(json result, uint32_t extranonce, string coinba
         }
     }
 
-    workID++;
+    prepareJob();
+}
+
+
+//The program the miners run for the current job - programVM's bytecode after the optimizer.
+//In verify mode a program that does not match the original on random headers runs unoptimized.
+vector<uint32_t> cGetWork::jobByteCode() {
+
+    if (optimizeMode == "off")
+        return programVM->byteCode;
+
+    vector<uint32_t> optimized = cProgramOptimizer::optimize(programVM->byteCode);
+    if ((optimizeMode == "verify") && !cProgramOptimizer::verify(programVM->byteCode, optimized, hashBlock, 64)) {
+        printf("Hash program optimizer failed verification, running the program unoptimized\n");
+        return programVM->byteCode;
+    }
+
+    return optimized;
+}
+
+
+//Snapshot the job the network thread just parsed and publish it to the miners.  Only the
+//network thread touches the parse state above, so none of this needs a lock.
+void cGetWork::prepareJob() {
+
+    cPreparedJob* job = new cPreparedJob();
+
+    job->jobID = jobID;
+    job->timeHex = timeHex;
+    if (transactionString != NULL)
+        job->transactionString = transactionString;
+    memcpy(job->header, nativeData, 80);
+    job->byteCode = jobByteCode();
+    cThreadedVM::decode(job->byteCode, job->threadedCode);
+    if (cProgramJIT::enabled && compileJIT)
+        job->jitProgram = cProgramJIT::compile(job->byteCode);
+
+    CSHA256 sha256;
+    sha256.Write(&nativeData[4], 32);
+    sha256.Finalize((unsigned char*)job->prevHashSHA);
+
+    SHA256_80_Midstate(job->midstate, nativeData);
+
+    if (miningMode == "solo") {
+        job->shareTarget = false;
+        job->difficulty = 0;
+        job->target = ReadBE64(nativeTarget);
+    }
+    else if (miningMode == "benchmark") {
+        job->shareTarget = false;
+        job->difficulty = 0;
+        job->target = 0;
+    }
+    else {
+        job->shareTarget = true;
+        job->difficulty = difficultyTarget;
+        job->target = (job->difficulty == 0) ? 0 : share_to_target(job->difficulty) * 65536;
+    }
+
+    publishJob(job);
+}
+
+
+//Readers pin the job they are working on in their own slot (a hazard pointer) so they never
+//take a lock.  The pin is re-checked against currentJob, so a job swapped out in between is
+//never returned.
+//One slot for each mining thread and the submit thread, called before any of them start.
+void cGetWork::allocJobReaders(int count) {
+
+    jobReaders = vector<atomic<const cPreparedJob*>>(count);
+    for (int i = 0; i < count; i++)
+        jobReaders[i] = NULL;
+}
+
+int cGetWork::registerJobReader() {
+
+    int reader = jobReaderCount++;
+    if (reader >= (int)jobReaders.size()) {
+        printf("More job readers than the %d allocated\n", (int)jobReaders.size());
+        exit(0);
+    }
+    jobReaders[reader] = NULL;
+    return reader;
+}
+
+const cPreparedJob* cGetWork::acquireJob(int reader) {
+
+    const cPreparedJob* job;
+    do {
+        job = currentJob.load();
+        jobReaders[reader].store(job);
+    } while (job != currentJob.load());
+
+    return job;
+}
+
+void cGetWork::releaseJob(int reader) {
+    jobReaders[reader].store(NULL, memory_order_release);
+}
+
+
+//Swaps the new job in, bumps the work generation and frees any retired job that no reader has
+//pinned any more and that has no nonces waiting to be submitted.  With replaces set the job is only published while replaces is still current.
+bool cGetWork::publishJob(cPreparedJob* job, const cPreparedJob* replaces) {
+
+    lock_guard<mutex> lock(publishLock);
+    if ((replaces != NULL) && (currentJob.load() != replaces))
+        return false;
+
+    job->workID = workID + 1;
+    cPreparedJob* oldJob = currentJob.exchange(job);
+    publishedAt = chrono::steady_clock::now().time_since_epoch().count();
+    workID = job->workID;
+
+    if (oldJob != NULL)
+        retiredJobs.push_back(oldJob);
+
+    int readerCount = min((int)jobReaderCount, (int)jobReaders.size());
+    for (size_t i = 0; i < retiredJobs.size(); ) {
+        bool pinned = false;
+        for (int r = 0; r < readerCount; r++)
+            if (jobReaders[r].load() == retiredJobs[i])
+                pinned = true;
+
+        if (pinned || (retiredJobs[i]->pendingSubmits.count > 0))
+            i++;
+        else {
+            delete retiredJobs[i];
+            retiredJobs.erase(retiredJobs.begin() + i);
+        }
+    }
+
+    return true;
+}
+
+//Called by the worker that finds the nonces of job used up.  The job is republished with ntime
+//one second later, which gives the header a whole new nonce space - the program only depends on
+//the merkle root and prevHash, and the midstate does not cover ntime.
+void cGetWork::rollJob(const cPreparedJob* job) {
+
+    if (currentJob.load() != job)
+        return;
+
+    cPreparedJob* rolled = new cPreparedJob(*job);
 
-    lockJob.unlock();
+    uint32_t ntime;
+    memcpy(&ntime, rolled->header + 68, 4);
+    ntime++;
+    memcpy(rolled->header + 68, &ntime, 4);
 
+    char hex[16];
+    sprintf(hex, "%08x", ntime);
+    rolled->timeHex = hex;
 
+    //another worker or the network thread got there first
+    if (!publishJob(rolled, job))
+        delete rolled;
 }
 
 static const char b58digits[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
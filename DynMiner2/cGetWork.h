@@ -14,6 +14,9 @@
 #include "common.h"
 #include "sha256.h"
 #include "struct.h"
+#include "cThreadedVM.h"
+#include "cProgramJIT.h"
+#include "cNonceSpace.h"
 
 #ifdef __linux__
 #include "curl/curl.h"
@@ -41,6 +44,39 @@ static bool bech32_decode(char* hrp, uint8_t* data, size_t* data_len, const char
 static bool convert_bits(uint8_t* out, size_t* outlen, int outbits, const uint8_t* in, size_t inlen, int inbits, int pad);
 static int b58check(unsigned char* bin, size_t binsz, const char* b58);
 
+//Count of queued references to a job, which starts at zero in a copied job
+class cJobRefs
+{
+public:
+	cJobRefs() : count(0) {}
+	cJobRefs(const cJobRefs&) : count(0) {}
+	void operator++(int) { count++; }
+	void operator--(int) { count--; }
+	atomic<int> count;
+};
+
+//Everything the miners need for one job, built once when the job arrives and never changed
+//afterwards.  The header SHA work that is the same for every nonce is done here.
+class cPreparedJob
+{
+public:
+	uint32_t workID;
+	string jobID;
+	unsigned char header[80];		//native header, the miners fill in the nonce at bytes 76-79
+	vector<uint32_t> byteCode;		//finalized hash program
+	vector<sThreadedOp> threadedCode;	//byteCode pre-decoded for cThreadedVM
+	shared_ptr<cProgramJIT> jitProgram;	//byteCode compiled to native code, NULL when the jit is off or cannot compile it
+	uint32_t prevHashSHA[8];		//SHA-256 of header bytes 4-35 (prevHash)
+	uint32_t midstate[8];			//SHA-256 state after header bytes 0-63
+	uint64_t target;				//64 bit target the hash is compared against
+	bool shareTarget;				//stratum/pool - target follows the share difficulty
+	uint32_t difficulty;			//share difficulty the target was decoded from
+	string timeHex;					//stratum - ntime echoed back on submit
+	string transactionString;		//solo/pool - block transactions appended on submit
+	mutable cNonceSpace nonces;		//leased to the CPU and GPU workers
+	mutable cJobRefs pendingSubmits;	//found nonces still queued for the submit thread
+};
+
 class cGetWork
 {
 public:
@@ -51,17 +87,30 @@ public:
 	void startStratumGetWork(int stratumSocket, cStatDisplay* statDisplay);
 	void startSoloGetWork(cStatDisplay* statDisplay);
 	void startPoolGetWork(int stratumSocket, cStatDisplay* statDisplay);
+	void startBenchmarkGetWork(cStatDisplay* statDisplay);
+	void loadBenchmarkJob();
+	void prepareJob();
+	vector<uint32_t> jobByteCode();
+	bool publishJob(cPreparedJob* job, const cPreparedJob* replaces = NULL);
+	void rollJob(const cPreparedJob* job);
+	void allocJobReaders(int count);
+	int registerJobReader();
+	const cPreparedJob* acquireJob(int reader);
+	void releaseJob(int reader);
 	json execRPC(string data);
 	static size_t WriteMemoryCallback(void* contents, size_t size, size_t nmemb, void* userp);
 
 	cStatDisplay* stats;
 
 	atomic<uint32_t> difficultyTarget{ 0 };
-	atomic<uint32_t> workID;
-	mutex lockJob;
+	atomic<uint32_t> workID;		//generation of currentJob, bumped after each swap
+	atomic<int64_t> publishedAt{ 0 };	//steady_clock ticks of the last swap, stored before workID
 
-	mutex lockNonce;
-	uint32_t nextNonce;
+	atomic<cPreparedJob*> currentJob{ NULL };
+	vector<atomic<const cPreparedJob*>> jobReaders;		//allocated once before the readers start
+	atomic<int> jobReaderCount{ 0 };
+	vector<cPreparedJob*> retiredJobs;
+	mutex publishLock;				//the network thread and rollJob both publish
 
 	string miningMode;
 	int* socketError;
@@ -81,6 +130,9 @@ public:
 	vector<string> program;
 	vector<uint32_t> byteCode;
 	cProgramVM* programVM;
+	string optimizeMode;			//on, off or verify - see cProgramOptimizer
+	bool compileJIT;				//compile prepared jobs for the jit engine, off for a job only a GPU runs
+	unsigned char* hashBlock;		//only read, to verify optimized programs
 
 	std::string strNativeTarget;
 	uint32_t iNativeTarget[8];
@@ -98,10 +150,6 @@ public:
 	string rpcPassword;
 	string rpcWallet;
 
-	//used by all miners
-	mutex nonceLock;
-	uint32_t masterNonce;
-
 	//used by pool to force coinbase
 	string miningWallet;
 
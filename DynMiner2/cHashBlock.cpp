@@ -0,0 +1,276 @@
+#include "cHashBlock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+string cHashBlock::pageType = "4KB pages";
+bool cHashBlock::zeroed = true;
+
+#ifdef __linux__
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static unsigned char* mapHuge(uint64_t size, int pageShift) {
+	uint64_t pageSize = 1ULL << pageShift;
+	size = (size + pageSize - 1) & ~(pageSize - 1);
+	void* block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+	return (block == MAP_FAILED) ? NULL : (unsigned char*)block;
+}
+
+//THP only backs 2MB aligned ranges, so the mapping is trimmed to start on a 2MB boundary
+static unsigned char* mapTransparent(uint64_t size) {
+	const uint64_t pageSize = 1ULL << 21;
+	size = (size + pageSize - 1) & ~(pageSize - 1);
+	unsigned char* block = (unsigned char*)mmap(NULL, size + pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (block == (unsigned char*)MAP_FAILED)
+		return NULL;
+
+	uint64_t head = (pageSize - ((uintptr_t)block & (pageSize - 1))) & (pageSize - 1);
+	if (head > 0)
+		munmap(block, head);
+	if (pageSize - head > 0)
+		munmap(block + head + size, pageSize - head);
+	block += head;
+
+	if (madvise(block, size, MADV_HUGEPAGE) != 0) {
+		munmap(block, size);
+		return NULL;
+	}
+	return block;
+}
+
+//mbind straight through the syscall, so there is no libnuma dependency
+#define MPOL_BIND_POLICY 2
+#define MPOL_INTERLEAVE_POLICY 3
+
+static bool setPolicy(unsigned char* block, uint64_t size, int policy, const vector<int>& nodes) {
+	unsigned long mask[16] = {};
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if ((nodes[i] < 0) || (nodes[i] >= 1024))
+			return false;
+		mask[nodes[i] / 64] |= 1UL << (nodes[i] % 64);
+	}
+
+	//calloc'd blocks do not start on a page
+	uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)block & ~(pageSize - 1);
+	return syscall(SYS_mbind, start, size + ((uintptr_t)block - start), policy, mask, 1024 + 1, 0) == 0;
+}
+#endif
+
+
+unsigned char* cHashBlock::allocate(uint64_t size, const string& hugePages) {
+
+	unsigned char* block = NULL;
+
+	//reserved pages are real RAM from the first read, worth it only for a block with content
+	bool reserved = (hugePages == "hugetlb") || ((hugePages == "on") && !zeroed);
+
+#ifdef __linux__
+	if (reserved) {
+		if ((block = mapHuge(size, 30)) != NULL)
+			pageType = "1GB hugetlbfs pages";
+		else if ((block = mapHuge(size, 21)) != NULL)
+			pageType = "2MB hugetlbfs pages";
+	}
+	if ((block == NULL) && (hugePages != "off")) {
+		if ((block = mapTransparent(size)) != NULL)
+			pageType = "transparent huge pages";
+	}
+#endif
+
+#ifdef _WIN32
+	//needs the "Lock pages in memory" privilege, without it VirtualAlloc fails and malloc is used.
+	//Large pages are committed up front, Windows has no transparent huge pages to fall back to.
+	SIZE_T largePage = GetLargePageMinimum();
+	if (reserved && (largePage > 0)) {
+		SIZE_T rounded = (size + largePage - 1) & ~(uint64_t)(largePage - 1);
+		block = (unsigned char*)VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (block != NULL)
+			pageType = "large pages";
+	}
+#endif
+
+	//calloc of a block this size is an mmap too, already zero and not touched
+	if (block == NULL) {
+		block = (unsigned char*)calloc(size, 1);
+		pageType = "4KB pages";
+	}
+
+	return block;
+}
+
+
+bool cHashBlock::bindToNode(unsigned char* block, uint64_t size, int node) {
+#ifdef __linux__
+	return setPolicy(block, size, MPOL_BIND_POLICY, vector<int>(1, node));
+#else
+	return false;
+#endif
+}
+
+
+bool cHashBlock::interleave(unsigned char* block, uint64_t size, const vector<int>& nodes) {
+#ifdef __linux__
+	return setPolicy(block, size, MPOL_INTERLEAVE_POLICY, nodes);
+#else
+	return false;
+#endif
+}
+
+
+#ifdef __linux__
+//a name with no '/' after the leading one is a shm_open object, anything else a file
+static int openShared(const string& name, int flags, mode_t mode) {
+	if (name.find('/', 1) == string::npos)
+		return shm_open(name.c_str(), flags, mode);
+	return open(name.c_str(), flags, mode);
+}
+#endif
+
+
+unsigned char* cHashBlock::attachShared(const string& name, uint64_t size, const unsigned char* content) {
+#ifdef __linux__
+	string ready = name + ".ready";
+
+	int fd = openShared(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd >= 0) {
+		//new, all zeros after ftruncate
+		if (ftruncate(fd, size) != 0) {
+			printf("Unable to size shared hash block %s\n", name.c_str());
+			close(fd);
+			return NULL;
+		}
+		void* block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (block == MAP_FAILED)
+			return NULL;
+
+		//the other processes only map it once it is complete
+		if (content != NULL)
+			memcpy(block, content, size);
+
+		int readyFd = openShared(ready, O_RDWR | O_CREAT, 0644);
+		if (readyFd < 0)
+			return NULL;
+		close(readyFd);
+
+		pageType = "shared block " + name + ", created";
+		return (unsigned char*)block;
+	}
+	if (errno != EEXIST) {
+		printf("Unable to create shared hash block %s: %s\n", name.c_str(), strerror(errno));
+		return NULL;
+	}
+
+	//another process owns it, give it a minute to finish
+	for (int i = 0; ; i++) {
+		int readyFd = openShared(ready, O_RDONLY, 0);
+		if (readyFd >= 0) {
+			close(readyFd);
+			break;
+		}
+		if (i == 600) {
+			printf("Shared hash block %s was never finished, remove it if the process that created it is gone\n", name.c_str());
+			return NULL;
+		}
+		if (i == 0)
+			printf("Waiting for shared hash block %s\n", name.c_str());
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	fd = openShared(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || ((uint64_t)st.st_size < size)) {
+		printf("Shared hash block %s is too small\n", name.c_str());
+		close(fd);
+		return NULL;
+	}
+	void* block = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (block == MAP_FAILED)
+		return NULL;
+
+	pageType = "shared block " + name + ", attached read only";
+	return (unsigned char*)block;
+#else
+	printf("Shared hash blocks are only supported on Linux\n");
+	return NULL;
+#endif
+}
+
+
+//frees a block allocate() returned as type
+static void release(unsigned char* block, uint64_t size, const string& type) {
+	if (type == "4KB pages") {
+		free(block);
+		return;
+	}
+#ifdef __linux__
+	uint64_t pageSize = 1ULL << ((type == "1GB hugetlbfs pages") ? 30 : 21);
+	munmap(block, (size + pageSize - 1) & ~(pageSize - 1));
+#endif
+#ifdef _WIN32
+	VirtualFree(block, 0, MEM_RELEASE);
+#endif
+}
+
+
+double cHashBlock::timeSumBlock(const string& hugePages, uint32_t reads, bool randomRows) {
+
+	//allocate() records what it got, the hash block's page type is kept
+	string blockPages = pageType;
+	unsigned char* block = allocate(SUMBLOCK_SPAN, hugePages);
+	string scratchPages = pageType;
+	pageType = blockPages;
+	if (block == NULL)
+		return 0;
+
+	for (uint64_t i = 0; i < SUMBLOCK_SPAN; i++)
+		block[i] = (unsigned char)((i * 2654435761u) >> 24);
+
+	uint32_t hash[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	//same row/col math as SUMBLOCK, each row depends on the bytes read before it
+	for (uint32_t r = 0; r < reads; r++) {
+		uint64_t row = (hash[0] + hash[1] + hash[2] + hash[3]) % 3072;
+		uint64_t col = (hash[4] + hash[5] + hash[6] + hash[7]) % 32768;
+		const unsigned char* p = &block[row * 32768 + col];
+		for (int i = 0; i < 256; i++)
+			hash[i % 8] += p[i];
+
+		if (randomRows)
+			for (int j = 0; j < 8; j++)
+				hash[j] = hash[j] * 2654435761u + (hash[(j + 1) % 8] >> 11);
+	}
+
+	double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+	//keeps the loop from being optimized away
+	if (hash[0] == 0x12345678)
+		printf(" ");
+
+	release(block, SUMBLOCK_SPAN, scratchPages);
+
+	return ns / reads;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define HASHBLOCK_SIZE (1024ULL * 1024ULL * 3072ULL)
+#define SUMBLOCK_SPAN (3072ULL * 32768ULL + 256)		//the bytes SUMBLOCK reads, its last row runs 256 bytes past row 3071
+
+//Allocates the 3GB hash block SUMBLOCK reads from.  SUMBLOCK reads 256 bytes at a hash dependent
+//row of the first ~100MB for every nonce, so on 4KB pages nearly every read is a TLB miss and a
+//page walk.  hugePages picks the pages:
+//  on       transparent huge pages (madvise(MADV_HUGEPAGE)) while the block is all zeros, reads
+//           map the kernel's huge zero page and cost no RAM.  A block with content (zeroed
+//           cleared before allocate) takes 1GB or 2MB hugetlbfs pages / Windows large pages.
+//  hugetlb  1GB or 2MB hugetlbfs pages / Windows large pages even for a zero block.  Fewest TLB
+//           misses, but hugetlbfs has no zero page and Windows commits large pages up front, so
+//           every page read costs real RAM - up to the whole 3GB.
+//  off      4KB pages
+//Each falls back to the next smaller pages.  hugetlbfs pages have to be reserved first, e.g.
+//vm.nr_hugepages=1536 for 2MB pages.  The block comes back zero filled without being written.
+class cHashBlock
+{
+public:
+	static unsigned char* allocate(uint64_t size, const string& hugePages);
+
+	//A block shared by every miner process on the host.  name is a POSIX shared memory object
+	//("/dynminer") or a file path, e.g. on /dev/shm or a hugetlbfs mount.  The first process
+	//creates it, copies content in (NULL for a zero block) and then creates name.ready, later
+	//processes wait for that and map the block read only.  Returns NULL when it cannot be set up.
+	//A shm or file mapping has no zero page: a zero block is left sparse, each page read is
+	//allocated once for all processes.  Worth it only when a private block would cost real pages
+	//in every process, -hugepages hugetlb or a block with content.
+	static unsigned char* attachShared(const string& name, uint64_t size, const unsigned char* content);
+
+	//NUMA placement for a block nothing has touched yet - its pages go to one node, or are spread
+	//round robin over several.  Linux only, returns false when the kernel refuses.
+	static bool bindToNode(unsigned char* block, uint64_t size, int node);
+	static bool interleave(unsigned char* block, uint64_t size, const vector<int>& nodes);
+
+	//Average ns per SUMBLOCK read, either at a new hash dependent row every time (TLB misses) or
+	//always at the same row (cache and TLB hits).  Timed on a scratch copy of the rows SUMBLOCK
+	//reads, allocated with the same hugePages mode and filled first - reads of the zero block
+	//would only hit the zero page, and the first ones would pay its page faults.
+	static double timeSumBlock(const string& hugePages, uint32_t reads, bool randomRows);
+
+	static string pageType;		//which pages allocate() got
+	static bool zeroed;			//the block is all zeros - clear this before allocate() when real content will be written to it
+};
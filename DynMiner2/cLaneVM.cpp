@@ -0,0 +1,327 @@
+#include "cLaneVM.h"
+#include "cMiner.h"
+#include "cGetWork.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LANE_DONE 0xFFFFFFFF
+
+cLaneVM::cLaneVM(uint32_t numLanes) {
+	lanes = numLanes;
+	memGen = (uint32_t*)MemRowsAlloc(lanes * 512 * 8 * sizeof(uint32_t));
+}
+
+cLaneVM::~cLaneVM() {
+	MemRowsFree(memGen);
+}
+
+
+//SHA-256 the current hash of the selected lanes.  The common case (every lane on the same line)
+//hashes in place, otherwise the lanes are packed together first so they still fill whole batches.
+void cLaneVM::shaLanes(const uint32_t* sel, uint32_t count) {
+
+	if (count == lanes) {
+		uint32_t l = 0;
+		for (; l + 8 <= lanes; l += 8)
+			SHA256_32_8way(&hash[0][l], LANEVM_MAX_LANES);
+		if (l < lanes)
+			SHA256_32_4way(&hash[0][l], LANEVM_MAX_LANES);
+		return;
+	}
+
+	for (uint32_t j = 0; j < 8; j++)
+		for (uint32_t i = 0; i < count; i++)
+			shaScratch[j][i] = hash[j][sel[i]];
+
+	uint32_t i = 0;
+	for (; i + 4 < count; i += 8)
+		SHA256_32_8way(&shaScratch[0][i], LANEVM_MAX_LANES);
+	if (i < count)
+		SHA256_32_4way(&shaScratch[0][i], LANEVM_MAX_LANES);
+
+	for (uint32_t j = 0; j < 8; j++)
+		for (uint32_t i = 0; i < count; i++)
+			hash[j][sel[i]] = shaScratch[j][i];
+}
+
+
+void cLaneVM::runProgram(const cPreparedJob* job, uint32_t firstNonce, uint32_t* hashResults, const unsigned char* hashBlock) {
+
+	const uint32_t* prevHashSHA = job->prevHashSHA;
+
+	unsigned char tail[16];
+	memcpy(tail, &job->header[64], 12);
+
+	for (uint32_t l = 0; l < lanes; l++) {
+		uint32_t nonce = firstNonce + l;
+		memcpy(&tail[12], &nonce, 4);
+
+		uint32_t laneHash[8];
+		SHA256_80_Tail((unsigned char*)laneHash, job->midstate, tail);
+		for (int j = 0; j < 8; j++)
+			hash[j][l] = laneHash[j];
+
+		linePtr[l] = 0;
+		memSize[l] = 0;
+		pending[l].clear();
+	}
+
+	const uint32_t* code = job->byteCode.data();
+	uint32_t sel[LANEVM_MAX_LANES];
+
+	while (1) {
+
+		//run the lanes sitting on the lowest line
+		uint32_t pc = LANE_DONE;
+		for (uint32_t l = 0; l < lanes; l++)
+			if (linePtr[l] < pc)
+				pc = linePtr[l];
+
+		if (pc == LANE_DONE)
+			break;
+
+		uint32_t count = 0;
+		for (uint32_t l = 0; l < lanes; l++)
+			if (linePtr[l] == pc)
+				sel[count++] = l;
+
+
+		switch (code[pc]) {
+
+		case HASHOP_ADD:
+			for (uint32_t j = 0; j < 8; j++)
+				for (uint32_t i = 0; i < count; i++)
+					hash[j][sel[i]] += code[pc + 1 + j];
+			for (uint32_t i = 0; i < count; i++)
+				linePtr[sel[i]] = pc + 9;
+			break;
+
+		case HASHOP_XOR:
+			for (uint32_t j = 0; j < 8; j++)
+				for (uint32_t i = 0; i < count; i++)
+					hash[j][sel[i]] ^= code[pc + 1 + j];
+			for (uint32_t i = 0; i < count; i++)
+				linePtr[sel[i]] = pc + 9;
+			break;
+
+		case HASHOP_SHA_SINGLE:
+			shaLanes(sel, count);
+			for (uint32_t i = 0; i < count; i++)
+				linePtr[sel[i]] = pc + 1;
+			break;
+
+		case HASHOP_SHA_LOOP:
+			for (uint32_t k = 0; k < code[pc + 1]; k++)
+				shaLanes(sel, count);
+			for (uint32_t i = 0; i < count; i++)
+				linePtr[sel[i]] = pc + 2;
+			break;
+
+		case HASHOP_MEMGEN:
+		case HASHOP_MEMGEN_PARTIAL: {
+			uint32_t rows = (code[pc] == HASHOP_MEMGEN) ? code[pc + 1] : code[pc + 2];
+			for (uint32_t i = 0; i < count; i++) {
+				memSize[sel[i]] = code[pc + 1];
+				pending[sel[i]].clear();
+			}
+
+			for (uint32_t row = 0; row < rows; row++) {
+				shaLanes(sel, count);
+				for (uint32_t i = 0; i < count; i++) {
+					uint32_t* dest = &memGen[sel[i] * 512 * 8 + row * 8];
+					for (uint32_t j = 0; j < 8; j++)
+						dest[j] = hash[j][sel[i]];
+				}
+			}
+			for (uint32_t i = 0; i < count; i++)
+				linePtr[sel[i]] = (code[pc] == HASHOP_MEMGEN) ? pc + 2 : pc + 3;
+			break;
+		}
+
+		//the memgen updates are only recorded, see cMemTransforms
+		case HASHOP_MEMADD:
+			for (uint32_t i = 0; i < count; i++) {
+				pending[sel[i]].push(&code[pc + 1], NULL, &memGen[sel[i] * 512 * 8], memSize[sel[i]]);
+				linePtr[sel[i]] = pc + 9;
+			}
+			break;
+
+		case HASHOP_MEMXOR:
+			for (uint32_t i = 0; i < count; i++) {
+				pending[sel[i]].push(NULL, &code[pc + 1], &memGen[sel[i] * 512 * 8], memSize[sel[i]]);
+				linePtr[sel[i]] = pc + 9;
+			}
+			break;
+
+		case HASHOP_MEMADDXOR:
+			for (uint32_t i = 0; i < count; i++) {
+				pending[sel[i]].push(&code[pc + 1], &code[pc + 9], &memGen[sel[i] * 512 * 8], memSize[sel[i]]);
+				linePtr[sel[i]] = pc + 17;
+			}
+			break;
+
+		case HASHOP_MEMADDHASHPREV:
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				uint32_t v[8];
+				for (uint32_t j = 0; j < 8; j++)
+					v[j] = hash[j][l] + prevHashSHA[j];
+				pending[l].push(v, NULL, &memGen[l * 512 * 8], memSize[l]);
+				linePtr[l] = pc + 1;
+			}
+			break;
+
+		case HASHOP_MEMXORHASHPREV:
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				uint32_t v[8];
+				for (uint32_t j = 0; j < 8; j++)
+					v[j] = hash[j][l];
+				pending[l].push(v, prevHashSHA, &memGen[l * 512 * 8], memSize[l]);
+				linePtr[l] = pc + 1;
+			}
+			break;
+
+		case HASHOP_MEM_SELECT:
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				uint32_t index = code[pc + 1] % memSize[l];
+				uint32_t row[8];
+				pending[l].read(&memGen[l * 512 * 8 + index * 8], row);
+				for (uint32_t j = 0; j < 8; j++)
+					hash[j][l] = row[j];
+				linePtr[l] = pc + 2;
+			}
+			break;
+
+		case HASHOP_READMEM2:
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				if (code[pc + 1] == 0) {
+					for (uint32_t j = 0; j < 8; j++)
+						hash[j][l] ^= prevHashSHA[j];
+				}
+				else if (code[pc + 1] == 1) {
+					for (uint32_t j = 0; j < 8; j++)
+						hash[j][l] += prevHashSHA[j];
+				}
+
+				uint32_t index = 0;
+				for (uint32_t j = 0; j < 8; j++)
+					index += hash[j][l];
+				index = index % memSize[l];
+
+				uint32_t row[8];
+				pending[l].read(&memGen[l * 512 * 8 + index * 8], row);
+				for (uint32_t j = 0; j < 8; j++)
+					hash[j][l] = row[j];
+				linePtr[l] = pc + 3;
+			}
+			break;
+
+		case HASHOP_LOOP:
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				uint32_t sum = 0;
+				for (uint32_t j = 0; j < 8; j++)
+					sum += hash[j][l];
+				loopCount[l] = sum % code[pc + 1] + 1;
+				loopLinePtr[l] = pc + 2;
+				linePtr[l] = pc + 2;
+			}
+			break;
+
+		case HASHOP_ENDLOOP:
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				loopCount[l]--;
+				linePtr[l] = (loopCount[l] > 0) ? loopLinePtr[l] : pc + 1;
+			}
+			break;
+
+		case HASHOP_IF:
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				uint32_t sum = 0;
+				for (uint32_t j = 0; j < 8; j++)
+					sum += hash[j][l];
+				linePtr[l] = pc + 3;
+				if (sum % code[pc + 1] == 0)
+					linePtr[l] += code[pc + 2];
+			}
+			break;
+
+		case HASHOP_STORETEMP:
+			for (uint32_t j = 0; j < 8; j++)
+				for (uint32_t i = 0; i < count; i++)
+					tempStore[j][sel[i]] = hash[j][sel[i]];
+			for (uint32_t i = 0; i < count; i++)
+				linePtr[sel[i]] = pc + 1;
+			break;
+
+		case HASHOP_EXECOP: {
+			//add and xor are done per lane, the lanes picking SHA are hashed together
+			uint32_t shaSel[LANEVM_MAX_LANES];
+			uint32_t shaCount = 0;
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				uint32_t sum = 0;
+				for (uint32_t j = 0; j < 8; j++)
+					sum += hash[j][l];
+
+				if (sum % 3 == 0) {
+					for (uint32_t j = 0; j < 8; j++)
+						hash[j][l] += tempStore[j][l];
+				}
+				else if (sum % 3 == 1) {
+					for (uint32_t j = 0; j < 8; j++)
+						hash[j][l] ^= tempStore[j][l];
+				}
+				else
+					shaSel[shaCount++] = l;
+
+				linePtr[l] = pc + 2;
+			}
+			if (shaCount > 0)
+				shaLanes(shaSel, shaCount);
+			break;
+		}
+
+		//every lane's row is requested before the first one is summed, so the misses overlap
+		case HASHOP_SUMBLOCK: {
+			uint64_t index[LANEVM_MAX_LANES];
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				uint64_t row = (hash[0][l] + hash[1][l] + hash[2][l] + hash[3][l]) % 3072;
+				uint64_t col = (hash[4][l] + hash[5][l] + hash[6][l] + hash[7][l]) % 32768;
+				index[i] = row * 32768 + col;
+				for (int k = 0; k < 256; k += 64)
+					PREFETCH(&hashBlock[index[i] + k]);
+				PREFETCH(&hashBlock[index[i] + 255]);
+			}
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t l = sel[i];
+				const uint64_t hashBlockSize = 1024ULL * 1024ULL * 3072ULL;
+				for (int k = 0; k < 256; k++)
+					hash[k % 8][l] += hashBlock[(index[i] + k) % hashBlockSize];
+				linePtr[l] = pc + 1;
+			}
+			break;
+		}
+
+		case HASHOP_END:
+			for (uint32_t i = 0; i < count; i++)
+				linePtr[sel[i]] = LANE_DONE;
+			break;
+
+		default:
+			printf("Unknown opcode %d in hash program\n", code[pc]);
+			exit(0);
+		}
+	}
+
+	for (uint32_t l = 0; l < lanes; l++)
+		for (uint32_t j = 0; j < 8; j++)
+			hashResults[l * 8 + j] = hash[j][l];
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+#include "sha256.h"
+#include "cMemTransforms.h"
+
+class cPreparedJob;
+
+using namespace std;
+
+#define LANEVM_MAX_LANES 16
+
+//Runs the hash program for several consecutive nonces in lockstep.  Lanes that sit on the same
+//line execute together, so the SHA steps can use the multi-lane SHA-256 transforms.  When LOOP,
+//IF or EXECOP send lanes different ways, the lanes on the lowest line run first until the rest
+//catch up again.
+class cLaneVM
+{
+public:
+	cLaneVM(uint32_t numLanes);
+	~cLaneVM();
+
+	void runProgram(const cPreparedJob* job, uint32_t firstNonce, uint32_t* hashResults, const unsigned char* hashBlock);
+
+	uint32_t lanes;
+
+private:
+	void shaLanes(const uint32_t* sel, uint32_t count);
+
+	//structure of arrays - word j of lane l is hash[j][l]
+	uint32_t hash[8][LANEVM_MAX_LANES];
+	uint32_t tempStore[8][LANEVM_MAX_LANES];
+	uint32_t shaScratch[8][LANEVM_MAX_LANES];
+
+	uint32_t linePtr[LANEVM_MAX_LANES];
+	uint32_t loopCount[LANEVM_MAX_LANES];
+	uint32_t loopLinePtr[LANEVM_MAX_LANES];
+	uint32_t memSize[LANEVM_MAX_LANES];
+
+	uint32_t* memGen;		//512 rows of 8 words per lane
+	cMemTransforms pending[LANEVM_MAX_LANES];		//memgen updates not yet applied to the rows
+};
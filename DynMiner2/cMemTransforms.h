@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#include "memgen_rows.h"
+
+#define MEMGEN_PENDING 16		//row transforms held back before they are applied to every row
+
+//MEMADD, MEMXOR, MEMADDXOR and the *HASHPREV ops change every memgen row the same way, per column
+//row = (row + add) ^ xor.  Rows are only ever read one at a time by MEM_SELECT/READMEM2, so the
+//updates are recorded here and replayed on the row that is read instead of on all of them.
+//MEMGEN rewrites every row and clears the list.
+class cMemTransforms
+{
+public:
+	uint32_t count;
+	bool lastXor;						//last entry has a non zero xor part
+	uint32_t add[MEMGEN_PENDING][8];
+	uint32_t xorValue[MEMGEN_PENDING][8];
+
+	void clear() { count = 0; }
+
+	//record row = (row + a) ^ x, either may be NULL
+	inline void push(const uint32_t* a, const uint32_t* x, uint32_t* memGen, uint32_t memSize) {
+
+		//(row + a1) ^ x1 followed by ^ x2, or by + a2 when x1 is zero, folds into one entry
+		if ((count > 0) && ((a == NULL) || !lastXor)) {
+			uint32_t last = count - 1;
+			if (a != NULL)
+				for (int j = 0; j < 8; j++)
+					add[last][j] += a[j];
+			if (x != NULL) {
+				for (int j = 0; j < 8; j++)
+					xorValue[last][j] ^= x[j];
+				lastXor = true;
+			}
+			return;
+		}
+
+		if (count == MEMGEN_PENDING)
+			apply(memGen, memSize);
+
+		if (a != NULL)
+			memcpy(add[count], a, 32);
+		else
+			memset(add[count], 0, 32);
+		if (x != NULL)
+			memcpy(xorValue[count], x, 32);
+		else
+			memset(xorValue[count], 0, 32);
+		lastXor = (x != NULL);
+		count++;
+	}
+
+	//the current value of a row
+	inline void read(const uint32_t* row, uint32_t* out) const {
+		uint32_t v[8];
+		memcpy(v, row, 32);
+		for (uint32_t k = 0; k < count; k++)
+			for (int j = 0; j < 8; j++)
+				v[j] = (v[j] + add[k][j]) ^ xorValue[k][j];
+		memcpy(out, v, 32);
+	}
+
+	//write the pending transforms through to every row, when the list is full
+	void apply(uint32_t* memGen, uint32_t memSize) {
+		MemRowsTransform(memGen, memSize, add, xorValue, count);
+		count = 0;
+	}
+};
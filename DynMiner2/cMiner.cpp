@@ -3,6 +3,13 @@
 #include "cSubmitter.h"
 #include "cStatDisplay.h"
 #include "cProgramVM.h"
+#include "cLaneVM.h"
+#include "cThreadedVM.h"
+#include "cProgramJIT.h"
+#include "cHashBlock.h"
+#include "cTopology.h"
+#include "cNonceAudit.h"
+#include "cGPUTuner.h"
 
 uint64_t BSWAP64(uint64_t x)
 {
@@ -33,22 +40,64 @@ void cMiner::startMiner(string params, cGetWork *getWork, cSubmitter* submitter,
     int deviceID;
 
     if (type == 'g') {
-        if ((vParams.size() != 5) && (vParams.size() != 6)) {
+        //GPU,auto,<platform>,<device> takes its settings from the profile, tuning the card when it has none
+        bool autoConfig = (vParams.size() == 4) && (vParams[1] == "auto");
+        if ((vParams.size() != 5) && (vParams.size() != 6) && !autoConfig) {
             printf("GPU miner must specify work items, platform ID and device ID\n");
             exit(0);
         }
-        int workSize = atoi(vParams[2].c_str());
-        int platformID = atoi(vParams[3].c_str());
-        int deviceID = atoi(vParams[4].c_str());
-        int gpuLoops = 1;
-        if (vParams.size() == 6)
-            gpuLoops = atoi(vParams[5].c_str());
-        startGPUMiner(numThread, platformID, deviceID, getWork, submitter, statDisplay, workSize, GPUIndex, gpuLoops, hashBlock);
+        int platformID = atoi(vParams[autoConfig ? 2 : 3].c_str());
+        int deviceID = atoi(vParams[autoConfig ? 3 : 4].c_str());
+        cGPUConfig config;
+        if (!autoConfig) {
+            config.computeUnits = numThread;
+            config.workSize = atoi(vParams[2].c_str());
+            if (vParams.size() == 6)
+                config.loops = atoi(vParams[5].c_str());
+        }
+
+        if (autoConfig || tune) {
+            cGPUTuner tuner(this, platformID, deviceID, hashBlock);
+            string key = tuner.deviceKey();
+            if (!tune && cGPUTuner::lookup(gpuProfile, key, config))
+                printf("GPU %d:%d using profile settings for %s: %zu work items, work size %zu, %d loops\n", platformID, deviceID, key.c_str(), config.computeUnits, config.workSize, config.loops);
+            else {
+                cGPUConfig tuned = tuner.tune(getWork->optimizeMode);
+                if (tuned.hashrate > 0) {
+                    config = tuned;
+                    cGPUTuner::save(gpuProfile, key, config);
+                }
+                else if (autoConfig) {
+                    printf("Unable to tune GPU %d:%d, give its settings with -miner GPU,<work items>,<work size>,%d,%d\n", platformID, deviceID, platformID, deviceID);
+                    exit(0);
+                }
+            }
+        }
+
+        startGPUMiner(config.computeUnits, platformID, deviceID, getWork, submitter, statDisplay, config.workSize, GPUIndex, config.loops, hashBlock);
     }
     else {
-        uint32_t startNonce = 0xFFFFFFFF / numThread;
+        uint32_t lanes = 8;
+        if (vParams.size() == 3)
+            lanes = atoi(vParams[2].c_str());
+        if ((lanes != 1) && (lanes != 4) && (lanes != 8) && (lanes != 16)) {
+            printf("CPU lanes must be 1, 4, 8 or 16: %s\n", params.c_str());
+            exit(0);
+        }
+
+        vector<int> placement;
+        if (topology->mode != "off")
+            placement = topology->placement();
+
         for (unsigned int i = 0; i < numThread; i++) {
-            thread minerThread(&cMiner::startCPUMiner, this, getWork, submitter, statDisplay, i, i * startNonce, hashBlock);
+            int pinCpu = -1;
+            int node = 0;
+            if (!placement.empty()) {
+                pinCpu = placement[i % placement.size()];
+                node = topology->nodeOf(pinCpu);
+            }
+            unsigned char* block = topology->nodeBlocks.empty() ? hashBlock : topology->nodeBlocks[node];
+            thread minerThread(&cMiner::startCPUMiner, this, getWork, submitter, statDisplay, i, block, lanes, pinCpu, node);
             minerThread.detach();
         }
     }
@@ -102,65 +151,158 @@ static void checkReturn(const char* call, int val) {
     }
 }
 
-void cMiner::startCPUMiner(cGetWork* getWork, cSubmitter* submitter, cStatDisplay* statDisplay, int cpuIndex, unsigned int startNonce, unsigned char* hashBlock) {
-    bool workReady = false;
-    while (!workReady) {
-        getWork->lockJob.lock();
-        workReady = (getWork->workID != 0);
-        getWork->lockJob.unlock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
+void cMiner::startCPUMiner(cGetWork* getWork, cSubmitter* submitter, cStatDisplay* statDisplay, int cpuIndex, unsigned char* hashBlock, uint32_t lanes, int pinCpu, int node) {
+    if ((pinCpu >= 0) && !cTopology::pinThread(pinCpu))
+        printf("CPU%d: unable to pin thread to CPU %d\n", cpuIndex, pinCpu);
 
+    while (getWork->workID == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-    unsigned char* buffHeader = (unsigned char*) malloc(80);
+    int jobReader = getWork->registerJobReader();
 
 
     char cKey[32];
     sprintf(cKey, "CPU%d", cpuIndex );
     basic_string<char> sKey(cKey);
-    statDisplay->addCard(sKey);
+    //per node hashrate, only kept on multi node machines
+    cHashCounter* hashes = statDisplay->addCard(sKey, statDisplay->nodeStats.empty() ? -1 : node);
+    cAuditWorker* auditWorker = (audit != NULL) ? audit->addWorker(sKey) : NULL;
+
+    cMinerScratch* scratch = new cMinerScratch();
+
+    cLaneVM* laneVM = NULL;
+    uint32_t* laneHashes = NULL;
+    if (lanes > 1) {
+        laneVM = new cLaneVM(lanes);
+        laneHashes = (uint32_t*)malloc(lanes * 32);
+    }
+    bool legacy = (cpuEngine == "legacy");
+
+    //pipelined: while one nonce waits for its SUMBLOCK row the thread runs the others
+    cPipelineSlot* pipeline = NULL;
+    if ((lanes == 1) && (cpuEngine == "pipelined"))
+        pipeline = new cPipelineSlot[PIPELINE_NONCES];
 
-    CSHA256 sha256;
+    //lane engines hash whole groups of lanes
+    cNonceLease lease(lanes);
 
     while (true) {
         if (!pause) {
 
-            int workID;
+            const cPreparedJob* job = getWork->acquireJob(jobReader);
 
-            getWork->lockJob.lock();
+            int workID = job->workID;
+            uint64_t auditKey = auditJobKey(workID, job->header);
+            uint64_t target = job->target;
 
-            workID = getWork->workID;
-            string jobID = getWork->jobID;
-            memcpy(buffHeader, getWork->nativeData, 80);
+            unsigned char hash[32];
 
+            //the first worker to find the job's nonces used up rolls it
+            bool exhausted = !lease.begin(job->nonces);
+            if (pipeline != NULL) {
+                for (uint32_t s = 0; (s < PIPELINE_NONCES) && !exhausted; s++) {
+                    if ((lease.left == 0) && !lease.refill(job->nonces)) {
+                        exhausted = true;
+                        break;
+                    }
+                    pipeline[s].nonce = lease.nonce++;
+                    lease.left--;
+                    cThreadedVM::begin(job, pipeline[s].nonce, pipeline[s].hash, &pipeline[s].scratch, &pipeline[s].resume);
+                }
+            }
+            if (exhausted) {
+                getWork->rollJob(job);
+                getWork->releaseJob(jobReader);
+                continue;
+            }
 
-            //int numZero = countLeadingZeros()
-            uint64_t target;
-            if (getWork->miningMode == "solo")
-                target = BSWAP64(((uint64_t*)getWork->nativeTarget)[0]);
-            else
-                target = share_to_target(getWork->difficultyTarget) * 65536;
+            //the hash loop must not touch the heap, benchmark mode checks it
+            uint64_t allocCount = threadAllocCount();
 
-            std::vector<unsigned int> program = getWork->programVM->byteCode;
+            while (workID == getWork->workID) {
+                if (benchmark && (threadAllocCount() != allocCount)) {
+                    printf("CPU%d: heap allocation inside the hash loop\n", cpuIndex);
+                    exit(0);
+                }
 
-            getWork->lockJob.unlock();
+                if ((lease.left == 0) && !lease.refill(job->nonces)) {
+                    getWork->rollJob(job);
+                    break;
+                }
+                uint32_t nonce = lease.nonce;
+
+                if (laneVM != NULL) {
+                    //only the last lease of a job can be shorter than the lanes
+                    uint32_t count = min(lanes, lease.left);
+                    laneVM->runProgram(job, nonce, laneHashes, hashBlock);
+                    for (uint32_t l = 0; l < count; l++) {
+                        uint64_t hash_int{};
+                        memcpy(&hash_int, &laneHashes[l * 8], 8);
+                        hash_int = htobe64(hash_int);
+                        if (hash_int < target)
+                            submitter->submitNonce(nonce + l, getWork, job);
+                    }
 
-            uint32_t nonce = startNonce;
-            unsigned char hash[32];
+                    if (auditWorker != NULL)
+                        auditWorker->record(auditKey, nonce, count);
+                    lease.nonce += count;
+                    lease.left -= count;
+                    hashes->add(count);
+                    continue;
+                }
 
-            while (workID == getWork->workID) {
-                memcpy(&buffHeader[76], &nonce, 4);
+                if (pipeline != NULL) {
+                    for (uint32_t s = 0; s < PIPELINE_NONCES; s++) {
+                        cPipelineSlot& slot = pipeline[s];
+                        if (!cThreadedVM::run(job, slot.hash, &slot.scratch, &slot.resume, hashBlock))
+                            continue;
+
+                        uint64_t hash_int{};
+                        memcpy(&hash_int, slot.hash, 8);
+                        hash_int = htobe64(hash_int);
+                        if (hash_int < target)
+                            submitter->submitNonce(slot.nonce, getWork, job);
+
+                        if (auditWorker != NULL)
+                            auditWorker->record(auditKey, slot.nonce, 1);
+                        hashes->add(1);
+
+                        if ((lease.left == 0) && !lease.refill(job->nonces)) {
+                            exhausted = true;
+                            break;
+                        }
+                        slot.nonce = lease.nonce++;
+                        lease.left--;
+                        cThreadedVM::begin(job, slot.nonce, slot.hash, &slot.scratch, &slot.resume);
+                    }
+                    //the nonces still in flight are dropped with the job
+                    if (exhausted) {
+                        getWork->rollJob(job);
+                        break;
+                    }
+                    continue;
+                }
 
-                runProgram(buffHeader, program, (unsigned int*)hash, sha256, hashBlock);
+                if (job->jitProgram)
+                    job->jitProgram->runProgram(job, nonce, (uint32_t*)hash, scratch, hashBlock);
+                else if (legacy)
+                    runProgram(job, nonce, (unsigned int*)hash, scratch, hashBlock);
+                else
+                    cThreadedVM::runProgram(job, nonce, (uint32_t*)hash, scratch, hashBlock);
                 uint64_t hash_int{};
                 memcpy(&hash_int, hash, 8);
                 hash_int = htobe64(hash_int);
                 if (hash_int < target)
-                    submitter->submitNonce(nonce, getWork, workID);
+                    submitter->submitNonce(nonce, getWork, job);
 
-                nonce++;
-                statDisplay->totalStats->nonce_count++;
+                if (auditWorker != NULL)
+                    auditWorker->record(auditKey, nonce, 1);
+                lease.nonce++;
+                lease.left--;
+                hashes->add(1);
             }
+
+            getWork->releaseJob(jobReader);
         }
         else
             std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -169,13 +311,7 @@ void cMiner::startCPUMiner(cGetWork* getWork, cSubmitter* submitter, cStatDispla
 }
 
 
-void sha256(unsigned int len, unsigned char* data, unsigned char* output, CSHA256 sha256) {
-    sha256.Reset();
-    sha256.Write(data, len);
-    sha256.Finalize(output);
-}
-
-void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteCode, unsigned int* myHashResult, CSHA256 _sha256, unsigned char* hashBlock) {
+void cMiner::runProgram(const cPreparedJob* job, uint32_t nonce, unsigned int* myHashResult, cMinerScratch* scratch, const unsigned char* hashBlock) {
 
     
     //hex2bin(myHeader, "40000000000002BFAAC1A438664DA0F203BAFF381DD2B32B38DC840C0EA176B125E3B335A40D0F5692310EB526E1855CC6524615EA80A5D6C2E9AA159A7927929F744353394F", 80);
@@ -188,13 +324,18 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
     }
     */
 
-    uint32_t myMemGen[512 * 8];
-    uint32_t tempStore[8];
+    //everything below is borrowed from the job or the thread's scratch, nothing is allocated per hash
+    uint32_t* myMemGen = scratch->memGen;
+    uint32_t* tempStore = scratch->tempStore;
 
-    uint32_t prevHashSHA[8];
-    sha256(32, &myHeader[4], (unsigned char*)prevHashSHA, _sha256);
+    const uint32_t* byteCode = job->byteCode.data();
+    const uint32_t* prevHashSHA = job->prevHashSHA;
 
-    sha256(80, myHeader, (unsigned char*)myHashResult, _sha256);
+    //only the last 16 bytes of the header change per nonce
+    unsigned char tail[16];
+    memcpy(tail, &job->header[64], 12);
+    memcpy(&tail[12], &nonce, 4);
+    SHA256_80_Tail((unsigned char*)myHashResult, job->midstate, tail);
 
     uint32_t linePtr = 0;
     uint32_t done = 0;
@@ -231,7 +372,7 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
 
 
         else if (byteCode[linePtr] == HASHOP_SHA_SINGLE) {
-            sha256(32, (unsigned char*)myHashResult, (unsigned char*)myHashResult, _sha256);
+            SHA256_32((unsigned char*)myHashResult, (unsigned char*)myHashResult);
             linePtr++;
         }
 
@@ -240,7 +381,7 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
             linePtr++;
             uint32_t loopCount = byteCode[linePtr];
             for (int i = 0; i < loopCount; i++) {
-                sha256(32, (unsigned char*)myHashResult, (unsigned char*)myHashResult, _sha256);
+                SHA256_32((unsigned char*)myHashResult, (unsigned char*)myHashResult);
             }
             linePtr++;
         }
@@ -252,7 +393,7 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
             currentMemSize = byteCode[linePtr];
 
             for (int i = 0; i < currentMemSize; i++) {
-                sha256(32, (unsigned char*)myHashResult, (unsigned char*)myHashResult, _sha256);
+                SHA256_32((unsigned char*)myHashResult, (unsigned char*)myHashResult);
                 for (int j = 0; j < 8; j++)
                     myMemGen[i * 8 + j] = myHashResult[j];
             }
@@ -262,12 +403,23 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
         }
 
 
+        else if (byteCode[linePtr] == HASHOP_MEMGEN_PARTIAL) {
+            currentMemSize = byteCode[linePtr + 1];
+
+            for (uint32_t i = 0; i < byteCode[linePtr + 2]; i++) {
+                SHA256_32((unsigned char*)myHashResult, (unsigned char*)myHashResult);
+                for (int j = 0; j < 8; j++)
+                    myMemGen[i * 8 + j] = myHashResult[j];
+            }
+
+            linePtr += 3;
+        }
+
+
         else if (byteCode[linePtr] == HASHOP_MEMADD) {
             linePtr++;
 
-            for (int i = 0; i < currentMemSize; i++)
-                for (int j = 0; j < 8; j++)
-                    myMemGen[i * 8 + j] += byteCode[linePtr + j];
+            MemRowsTransform1(myMemGen, currentMemSize, &byteCode[linePtr], NULL);
 
             linePtr += 8;
         }
@@ -275,10 +427,10 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
         else if (byteCode[linePtr] == HASHOP_MEMADDHASHPREV) {
             linePtr++;
 
-            for (int i = 0; i < currentMemSize; i++)
-                for (int j = 0; j < 8; j++) {
-                    myMemGen[i * 8 + j] += myHashResult[j] + prevHashSHA[j];
-                }
+            uint32_t add[8];
+            for (int j = 0; j < 8; j++)
+                add[j] = myHashResult[j] + prevHashSHA[j];
+            MemRowsTransform1(myMemGen, currentMemSize, add, NULL);
 
         }
 
@@ -286,21 +438,23 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
         else if (byteCode[linePtr] == HASHOP_MEMXOR) {
             linePtr++;
 
-            for (int i = 0; i < currentMemSize; i++)
-                for (int j = 0; j < 8; j++)
-                    myMemGen[i * 8 + j] ^= byteCode[linePtr + j];
+            MemRowsTransform1(myMemGen, currentMemSize, NULL, &byteCode[linePtr]);
 
             linePtr += 8;
         }
 
+        else if (byteCode[linePtr] == HASHOP_MEMADDXOR) {
+            linePtr++;
+
+            MemRowsTransform1(myMemGen, currentMemSize, &byteCode[linePtr], &byteCode[linePtr + 8]);
+
+            linePtr += 16;
+        }
+
         else if (byteCode[linePtr] == HASHOP_MEMXORHASHPREV) {
             linePtr++;
 
-            for (int i = 0; i < currentMemSize; i++)
-                for (int j = 0; j < 8; j++) {
-                    myMemGen[i * 8 + j] += myHashResult[j];
-                    myMemGen[i * 8 + j] ^= prevHashSHA[j];
-                }
+            MemRowsTransform1(myMemGen, currentMemSize, myHashResult, prevHashSHA);
 
         }
 
@@ -403,7 +557,7 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
             }
 
             else if (sum % 3 == 2) {
-                sha256(32, (unsigned char*)myHashResult, (unsigned char*)myHashResult, _sha256);
+                SHA256_32((unsigned char*)myHashResult, (unsigned char*)myHashResult);
             }
 
         }
@@ -433,13 +587,10 @@ void cMiner::runProgram(unsigned char* myHeader, std::vector<unsigned int> byteC
 
 void cMiner::startGPUMiner(const size_t computeUnits, int platformID, int deviceID, cGetWork *getWork, cSubmitter *submitter, cStatDisplay *statDisplay, size_t gpuWorkSize, uint32_t GPUIndex, int gpuLoops, unsigned char* hashBlock) {
 
-    bool workReady = false;
-    while (!workReady) {
-        getWork->lockJob.lock();
-        workReady = (getWork->workID != 0);
-        getWork->lockJob.unlock();
+    while (getWork->workID == 0)
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
+
+    int jobReader = getWork->registerJobReader();
 
     cl_int returnVal; 
     cl_uint ret_num_platforms;
@@ -456,8 +607,6 @@ void cMiner::startGPUMiner(const size_t computeUnits, int platformID, int device
     unsigned char* buffHeader;
 
     uint32_t nonceBuffSize;
-    cl_mem clNonceBuffer;
-    uint32_t* buffNonce;
 
     cl_mem clProgStartTime;
 
@@ -476,137 +625,263 @@ void cMiner::startGPUMiner(const size_t computeUnits, int platformID, int device
     cl_context context = clCreateContext(NULL, 1, &open_cl_devices[deviceID], NULL, NULL, &returnVal);
 
     cl_ulong maxMemAlloc;
+    cl_ulong globalMem;
     size_t sizeRet;
     clGetDeviceInfo(open_cl_devices[deviceID], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxMemAlloc, &sizeRet);
+    clGetDeviceInfo(open_cl_devices[deviceID], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, &sizeRet);
+
+    //-gpubatchms: the global size follows the measured kernel time, from one work group up to
+    //GPU_BATCH_GROWTH times the configured size, as far as the memgen buffer can be allocated
+    size_t hashBockSize = 1024ULL * 1024ULL * 3072ULL;
+    size_t memgenItemSize = 512 * 8 * sizeof(uint32_t);
+    size_t maxGlobalSize = computeUnits;
+    if (batchTargetMs > 0) {
+        size_t fit = maxMemAlloc / memgenItemSize;
+        if (globalMem > hashBockSize)
+            fit = min(fit, (size_t)((globalMem - hashBockSize) / 10 * 9 / (memgenItemSize + 32)));
+        maxGlobalSize = max(computeUnits, min(computeUnits * GPU_BATCH_GROWTH, fit) / gpuWorkSize * gpuWorkSize);
+    }
 
 
     cl_program program = loadMiner(context, &open_cl_devices[deviceID], gpuLoops);
 
     kernel = clCreateKernel(program, "dyn_hash", &returnVal);
-    commandQueue = clCreateCommandQueueWithProperties(context, open_cl_devices[deviceID], NULL, &returnVal);
+    cl_queue_properties profiling[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+    commandQueue = clCreateCommandQueueWithProperties(context, open_cl_devices[deviceID], (batchTargetMs > 0) ? profiling : NULL, &returnVal);
+    checkReturn("clCreateCommandQueueWithProperties", returnVal);
 
     size_t programBufferSize = 8192;  //getWork->programVM->byteCode.size() * 4
     clGPUProgramBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, programBufferSize, NULL, &returnVal);
     checkReturn("clSetKernelArg - program", clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&clGPUProgramBuffer));
 
-    hashResultSize = computeUnits * 32;
+    //the memgen buffer decides how far the batch can grow, a card that cannot hold the larger one keeps the configured size
+    size_t memgenBufferSize = memgenItemSize * maxGlobalSize;        //TODO - analyze program to find maximum memgen size
+    clMemgenBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, memgenBufferSize, NULL, &returnVal);
+    if ((returnVal != CL_SUCCESS) && (maxGlobalSize > computeUnits)) {
+        maxGlobalSize = computeUnits;
+        memgenBufferSize = memgenItemSize * maxGlobalSize;
+        clMemgenBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, memgenBufferSize, NULL, &returnVal);
+    }
+    checkReturn("clSetKernelArg - clMemgenBuffer", clSetKernelArg(kernel, 5, sizeof(cl_mem), (void*)&clMemgenBuffer));
+
+    hashResultSize = maxGlobalSize * 32;
     clGPUHashResultBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, hashResultSize, NULL, &returnVal);
     checkReturn("clSetKernelArg - hash", clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&clGPUHashResultBuffer));
     buffHashResult = (uint32_t*)malloc(hashResultSize);
 
-    headerBuffSize = 80;
+    headerBuffSize = 80 + 32 + 32;      //header, midstate, prevHash SHA
     clGPUHeaderBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, headerBuffSize, NULL, &returnVal);
     checkReturn("clSetKernelArg - header", returnVal = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&clGPUHeaderBuffer));
     buffHeader = (unsigned char*)malloc(headerBuffSize);
 
-    nonceBuffSize = sizeof(cl_uint) * 0x100;
-    
-    clNonceBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, nonceBuffSize, NULL, &returnVal);
-    checkReturn("clSetKernelArg - nonce", clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&clNonceBuffer));
-    buffNonce = (uint32_t*)malloc(nonceBuffSize);
-
-
-    size_t memgenBufferSize = 512 * 8 * computeUnits * sizeof(uint32_t);        //TODO - analyze program to find maximum memgen size
-    clMemgenBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, memgenBufferSize, NULL, &returnVal);
-    checkReturn("clSetKernelArg - clMemgenBuffer", clSetKernelArg(kernel, 5, sizeof(cl_mem), (void*)&clMemgenBuffer));
+    //each batch in flight has its own result buffer, read back into pinned host memory
+    nonceBuffSize = sizeof(cl_uint) * 0x101;
+    cGPUBatch batches[GPU_PIPELINE_DEPTH];
+    for (int b = 0; b < GPU_PIPELINE_DEPTH; b++) {
+        batches[b].nonceBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE, nonceBuffSize, NULL, &returnVal);
+        checkReturn("clCreateBuffer - nonce", returnVal);
+        batches[b].pinnedBuffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, nonceBuffSize, NULL, &returnVal);
+        checkReturn("clCreateBuffer - pinned nonce", returnVal);
+        batches[b].results = (uint32_t*)clEnqueueMapBuffer(commandQueue, batches[b].pinnedBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, nonceBuffSize, 0, NULL, NULL, &returnVal);
+        checkReturn("clEnqueueMapBuffer - pinned nonce", returnVal);
+    }
 
 
-    size_t hashBockSize = 1024ULL * 1024ULL * 3072ULL;
     clHashBlock = clCreateBuffer(context, CL_MEM_READ_WRITE, hashBockSize, NULL, &returnVal);
     checkReturn("clSetKernelArg - clHashBlock", clSetKernelArg(kernel, 6, sizeof(cl_mem), (void*)&clHashBlock));
 
+    //set when the job changes, the kernels read it between loops and stop.  It is written through
+    //a second queue, the first one is busy with the kernels that read it.  Whether a running
+    //kernel sees the write is up to the runtime, the first aborts tell.
+    static const cl_uint abortSet = 1;
+    static const cl_uint abortClear = 0;
+    cl_command_queue abortQueue = clCreateCommandQueueWithProperties(context, open_cl_devices[deviceID], NULL, &returnVal);
+    checkReturn("clCreateCommandQueueWithProperties - abort", returnVal);
+    cl_mem clAbortBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_uint), NULL, &returnVal);
+    checkReturn("clCreateBuffer - abort", returnVal);
+    checkReturn("clEnqueueWriteBuffer - abort", clEnqueueWriteBuffer(commandQueue, clAbortBuffer, CL_TRUE, 0, sizeof(cl_uint), &abortClear, 0, NULL, NULL));
+    checkReturn("clSetKernelArg - abort", clSetKernelArg(kernel, 7, sizeof(cl_mem), (void*)&clAbortBuffer));
+    cl_event abortWritten = NULL;
+    uint32_t abortsSeen = 0;            //aborts that caught a kernel running, and how many of those it stopped
+    uint32_t abortsHonoured = 0;
+
     char cKey[32];
     sprintf(cKey, "%02d:%02d.0", platformID, deviceID);
     //string sKey = string::basic_string(cKey);
     basic_string<char> sKey(cKey);
-    statDisplay->addCard(sKey);
+    cHashCounter* hashes = statDisplay->addCard(sKey);
+    cStats* card = statDisplay->cardStats(sKey);
+    cAuditWorker* auditWorker = (audit != NULL) ? audit->addWorker(sKey) : NULL;
+    for (int b = 0; b < GPU_PIPELINE_DEPTH; b++)
+        batches[b].coverage = (auditWorker != NULL) ? (uint32_t*)malloc(hashResultSize) : NULL;
 
-    memset(hashBlock, 0, hashBockSize);
-    checkReturn("clEnqueueWriteBuffer - hashblock", clEnqueueWriteBuffer(commandQueue, clHashBlock, CL_TRUE, 0, hashBockSize, hashBlock, 0, NULL, NULL));
+    //an untouched block is zeros, the device clears its copy itself instead of 3GB crossing PCIe
+    cl_uint zeroPattern = 0;
+    if (!cHashBlock::zeroed || (clEnqueueFillBuffer(commandQueue, clHashBlock, &zeroPattern, sizeof(zeroPattern), 0, hashBockSize, 0, NULL, NULL) != CL_SUCCESS))
+        checkReturn("clEnqueueWriteBuffer - hashblock", clEnqueueWriteBuffer(commandQueue, clHashBlock, CL_TRUE, 0, hashBockSize, hashBlock, 0, NULL, NULL));
 
+    size_t globalSize = computeUnits;       //work items of the next batch, kept across jobs
+    double itemMs = 0;                      //average kernel time per work item
 
     while (true) {
 
         if (!pause) {
 
-            int workID;
-
+            const cPreparedJob* job = getWork->acquireJob(jobReader);
 
-            getWork->lockJob.lock();
+            int workID = job->workID;
+            uint64_t auditKey = auditJobKey(workID, job->header);
 
-            //uint32_t openCLprogramLoops = 8;
+            memcpy(buffHeader, job->header, 80);
+            memcpy(buffHeader + 80, job->midstate, 32);
+            memcpy(buffHeader + 112, job->prevHashSHA, 32);
+            checkReturn("clEnqueueWriteBuffer - header", clEnqueueWriteBuffer(commandQueue, clGPUHeaderBuffer, CL_TRUE, 0, headerBuffSize, buffHeader, 0, NULL, NULL));
 
-            workID = getWork->workID;
-            string jobID = getWork->jobID;
-            memcpy(buffHeader, getWork->nativeData, 80);
-
-            checkReturn("clEnqueueWriteBuffer - program", clEnqueueWriteBuffer(commandQueue, clGPUProgramBuffer, CL_TRUE, 0, getWork->programVM->byteCode.size() * 4, getWork->programVM->byteCode.data(), 0, NULL, NULL));
+            checkReturn("clEnqueueWriteBuffer - program", clEnqueueWriteBuffer(commandQueue, clGPUProgramBuffer, CL_TRUE, 0, job->byteCode.size() * 4, job->byteCode.data(), 0, NULL, NULL));
             
-            uint64_t target = 0;
-
-            if (getWork->miningMode == "solo") {
-                target = BSWAP64(((uint64_t*)getWork->nativeTarget)[0]);
-                //checkReturn("clSetKernelArg - target", clSetKernelArg(kernel, 4, sizeof(cl_ulong), &getWork->targetZeros));
-                checkReturn("clSetKernelArg - target", clSetKernelArg(kernel, 4, sizeof(cl_ulong), &target));
-            }
-            else if ((getWork->miningMode == "stratum") || (getWork->miningMode == "pool")) {
-                target = share_to_target(getWork->difficultyTarget) * 65536;
-                //checkReturn("clSetKernelArg - target", clSetKernelArg(kernel, 4, sizeof(cl_ulong), &getWork->targetZeros));
-                checkReturn("clSetKernelArg - target", clSetKernelArg(kernel, 4, sizeof(cl_ulong), &target));
+            uint32_t difficulty = job->difficulty;
+            uint64_t target = job->target;
+            checkReturn("clSetKernelArg - target", clSetKernelArg(kernel, 4, sizeof(cl_ulong), &target));
+
+            size_t localWorkSize = gpuWorkSize;
+            static const cl_uint zero[2] = { 0, 0 };      //found and skipped counts
+
+            //Up to GPU_PIPELINE_DEPTH batches are queued, so the device starts the next kernel as
+            //soon as one ends while the host submits the results of the one before.  The queue
+            //is in order, the batches share the memgen and hash buffers.  Batches of a job are
+            //drained before the next job, the job has to stay pinned until its nonces are submitted.
+            uint32_t oldest = 0;
+            uint32_t inFlight = 0;
+            bool exhausted = false;
+            bool aborted = false;
+            bool probe = false;             //the abort caught the oldest batch's kernel running
+
+            //the batches of the last job are all done.  Cleared after the abort write, or that could
+            //land on the new job's batches.
+            if (abortWritten != NULL) {
+                checkReturn("clEnqueueWriteBuffer - abort", clEnqueueWriteBuffer(commandQueue, clAbortBuffer, CL_FALSE, 0, sizeof(cl_uint), &abortClear, 1, &abortWritten, NULL));
+                clReleaseEvent(abortWritten);
+                abortWritten = NULL;
             }
 
-            getWork->lockJob.unlock();
-
-            // WARNING: what if they have multiple platforms?
-            //uint32_t MinNonce = (0xFFFFFFFFULL / numOpenCLDevices) * GPUIndex;
-            //uint32_t MaxNonce = MinNonce + (0xFFFFFFFFULL / numOpenCLDevices);
-            //uint32_t nonce = MinNonce;
-
-
+            while ((!exhausted && (workID == getWork->workID)) || (inFlight > 0)) {
+                if (!exhausted && (workID == getWork->workID) && (inFlight < GPU_PIPELINE_DEPTH)) {
+                    cGPUBatch& batch = batches[(oldest + inFlight) % GPU_PIPELINE_DEPTH];
+                    //the kernel hashes gpuLoops nonces per work item, from the global offset
+                    batch.globalSize = globalSize;
+                    if (!job->nonces.lease(globalSize * gpuLoops, batch.nonce, batch.count)) {
+                        getWork->rollJob(job);
+                        exhausted = true;
+                        continue;
+                    }
 
-            while (workID == getWork->workID) {
-                getWork->lockNonce.lock();
-                uint32_t nonce = getWork->nextNonce;
-                getWork->nextNonce += computeUnits * gpuLoops;
-                getWork->lockNonce.unlock();
-
-                if ((getWork->miningMode == "stratum") || (getWork->miningMode == "pool")) {
-                    uint64_t newTarget = share_to_target(getWork->difficultyTarget) * 65536;
-                    if (newTarget != target) {
-                        target = newTarget;
+                    //share difficulty can change in the middle of a stratum/pool job
+                    if (job->shareTarget && (getWork->difficultyTarget != difficulty)) {
+                        difficulty = getWork->difficultyTarget;
+                        target = share_to_target(difficulty) * 65536;
                         checkReturn("clSetKernelArg - target", clSetKernelArg(kernel, 4, sizeof(cl_ulong), &target));
-                        //checkReturn("clSetKernelArg - target", clSetKernelArg(kernel, 4, sizeof(cl_ulong), &getWork->targetZeros));
                     }
-                }
 
+                    size_t gOffset = batch.nonce;
+                    checkReturn("clEnqueueWriteBuffer - NonceRetBuf", clEnqueueWriteBuffer(commandQueue, batch.nonceBuffer, CL_FALSE, sizeof(cl_uint) * 0xFF, sizeof(zero), zero, 0, NULL, NULL));
+                    checkReturn("clSetKernelArg - nonce", clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&batch.nonceBuffer));
+                    checkReturn("clEnqueueNDRangeKernel", clEnqueueNDRangeKernel(commandQueue, kernel, 1, &gOffset, &batch.globalSize, &localWorkSize, 0, NULL, &batch.kernelDone));
+                    if (auditWorker != NULL)
+                        checkReturn("clEnqueueReadBuffer - coverage", clEnqueueReadBuffer(commandQueue, clGPUHashResultBuffer, CL_FALSE, 0, batch.globalSize * 2 * sizeof(cl_uint), batch.coverage, 0, NULL, NULL));
+                    checkReturn("clEnqueueReadBuffer - nonce", clEnqueueReadBuffer(commandQueue, batch.nonceBuffer, CL_FALSE, 0, nonceBuffSize, batch.results, 0, NULL, &batch.done));
+                    checkReturn("clFlush", clFlush(commandQueue));
+                    inFlight++;
+                    continue;
+                }
 
-                memcpy(&buffHeader[76], &nonce, 4);
-                uint32_t zero = 0;
-                size_t gOffset = nonce;
+                //poll the batch so a new job aborts it instead of waiting for the kernel to end
+                cGPUBatch& batch = batches[oldest];
+                while (!aborted) {
+                    cl_int status;
+                    checkReturn("clGetEventInfo", clGetEventInfo(batch.done, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL));
+                    if (status <= CL_COMPLETE)
+                        break;
+                    if (workID != getWork->workID) {
+                        checkReturn("clEnqueueWriteBuffer - abort", clEnqueueWriteBuffer(abortQueue, clAbortBuffer, CL_FALSE, 0, sizeof(cl_uint), &abortSet, 0, NULL, &abortWritten));
+                        checkReturn("clFlush", clFlush(abortQueue));
+                        cl_int kernelStatus;
+                        checkReturn("clGetEventInfo", clGetEventInfo(batch.kernelDone, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &kernelStatus, NULL));
+                        probe = (kernelStatus == CL_RUNNING);
+                        aborted = true;
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                checkReturn("clWaitForEvents", clWaitForEvents(1, &batch.done));
+                clReleaseEvent(batch.done);
+                uint32_t skipped = min(batch.results[0x100], batch.count);
+
+                //a kernel that was running at the abort and still hashed every nonce did not see the
+                //flag, it may just have been about to end.  Reported once either way.
+                if (probe) {
+                    probe = false;
+                    abortsSeen++;
+                    if ((skipped > 0) && (abortsHonoured++ == 0))
+                        printf("GPU %s: running batches stop when the job changes\n", sKey.c_str());
+                    if ((abortsSeen == 4) && (abortsHonoured == 0))
+                        printf("GPU %s: the device does not see the abort flag while a kernel runs, a job change waits for the batches in flight\n", sKey.c_str());
+                }
 
-                checkReturn("clEnqueueWriteBuffer - header", clEnqueueWriteBuffer(commandQueue, clGPUHeaderBuffer, CL_TRUE, 0, headerBuffSize, buffHeader, 0, NULL, NULL));
-                checkReturn("clEnqueueWriteBuffer - NonceRetBuf", clEnqueueWriteBuffer(commandQueue, clNonceBuffer, CL_TRUE, sizeof(cl_uint) * 0xFF, sizeof(cl_uint), &zero, 0, NULL, NULL));
-                size_t localWorkSize = gpuWorkSize;
-                checkReturn("clEnqueueNDRangeKernel", clEnqueueNDRangeKernel(commandQueue, kernel, 1, &gOffset, &computeUnits, &localWorkSize, 0, NULL, NULL));
-                checkReturn("clFinish", clFinish(commandQueue));
-                checkReturn("clEnqueueReadBuffer - nonce", clEnqueueReadBuffer(commandQueue, clNonceBuffer, CL_TRUE, 0, sizeof(cl_uint) * 0x100, buffNonce, 0, NULL, NULL));
+                //size the next batches for the target kernel time from a moving average of the time
+                //per work item, at most 2x per step.  A new size has to get a quarter closer to the
+                //target, so a target between two work group multiples does not flap.
+                if (batchTargetMs > 0) {
+                    cl_ulong start, end;
+                    checkReturn("clGetEventProfilingInfo", clGetEventProfilingInfo(batch.kernelDone, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL));
+                    checkReturn("clGetEventProfilingInfo", clGetEventProfilingInfo(batch.kernelDone, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL));
+                    double ms = (double)(end - start) / 1000000;
+                    if ((ms > 0) && (skipped == 0)) {
+                        double msPerItem = ms / batch.globalSize;
+                        itemMs = (itemMs == 0) ? msPerItem : itemMs * 0.875 + msPerItem * 0.125;
+                        double ideal = min(max(batchTargetMs / itemMs, globalSize * 0.5), globalSize * 2.0);
+                        size_t want = (size_t)(ideal + localWorkSize / 2) / localWorkSize * localWorkSize;
+                        want = min(max(want, localWorkSize), maxGlobalSize);
+                        double error = fabs(globalSize * itemMs - batchTargetMs);
+                        if ((want != globalSize) && (fabs(want * itemMs - batchTargetMs) < error * 0.75)) {
+                            printf("GPU %s: %.1f ms kernel, batch resized to %zu work items\n", sKey.c_str(), itemMs * globalSize, want);
+                            globalSize = want;
+                        }
+                    }
+                }
+                clReleaseEvent(batch.kernelDone);
 
-                //printf("num nonce %d\n", buffNonce[0xFF]);
-                for (int i = 0; i < buffNonce[0xFF]; ++i)
+                //a short last lease still runs the whole batch, what ran past the end of the job is dropped
+                uint32_t found = min(batch.results[0xFF], (uint32_t)0xFF);
+                for (uint32_t i = 0; i < found; i++)
                 {
-                    submitter->submitNonce(buffNonce[i], getWork, workID);
+                    if (batch.results[i] - batch.nonce < batch.count)
+                        submitter->submitNonce(batch.results[i], getWork, job);
                 }
 
-                //nonce += computeUnits * gpuLoops;
-                statDisplay->totalStats->nonce_count += computeUnits * gpuLoops;
+                //the nonces each work item reports it hashed, not the lease, so an indexing bug or an
+                //aborted batch shows up.  What ran past the end of a short last lease is cut off.
+                if (auditWorker != NULL)
+                    for (size_t i = 0; i < batch.globalSize; i++) {
+                        uint64_t first = batch.coverage[i * 2];
+                        uint64_t end = min(first + batch.coverage[i * 2 + 1], (uint64_t)batch.nonce + batch.count);
+                        if (end > first)
+                            auditWorker->record(auditKey, (uint32_t)first, (uint32_t)(end - first));
+                    }
+                hashes->add(batch.count - skipped);
 
-                /*
-                if (nonce >= MaxNonce)
-                {
-                    printf("WARNING: GPU ran out of work!\nTODO: Fix me.\n.");
-                }
-                */
+                oldest = (oldest + 1) % GPU_PIPELINE_DEPTH;
+                inFlight--;
+            }
+
+            //every job switch, aborted or not, timed from the new job's publish until the old job's
+            //batches were drained.  Several publishes in between count from the last one.
+            if (workID != getWork->workID) {
+                chrono::steady_clock::time_point published{ chrono::steady_clock::duration(getWork->publishedAt.load()) };
+                card->staleMicros += max((int64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - published).count(), (int64_t)0);
+                card->jobSwitches++;
             }
+
+            getWork->releaseJob(jobReader);
         }
         else
             std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -634,7 +909,8 @@ vector<string> cMiner::split(string str, string token) {
 }
 
 
-cl_program cMiner::loadMiner(cl_context context, cl_device_id* deviceID, int gpuLoops) {
+//required - exit when the program does not build, otherwise return NULL
+cl_program cMiner::loadMiner(cl_context context, cl_device_id* deviceID, int gpuLoops, bool required) {
 
     FILE* kernelSourceFile;
     cl_int returnVal;
@@ -683,6 +959,13 @@ cl_program cMiner::loadMiner(cl_context context, cl_device_id* deviceID, int gpu
 
 
     
+    if ((returnVal != CL_SUCCESS) && !required) {
+        printf("OpenCL program does not build with GPU_LOOPS=%d\n", gpuLoops);
+        clReleaseProgram(program);
+        free(kernelSource);
+        return NULL;
+    }
+
     if (returnVal != CL_SUCCESS) {
         printf("Error building openCL program:\n");
         size_t log_size;
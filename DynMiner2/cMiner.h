@@ -8,11 +8,17 @@
 #include "version.h"
 
 #include "sha256.h"
+#include "allocCount.h"
+#include "cMemTransforms.h"
+#include "cThreadedVM.h"
 
 class cGetWork;
 class cSubmitter;
 class cStatDisplay;
 class cProgramVM;
+class cPreparedJob;
+class cTopology;
+class cNonceAudit;
 
 using namespace std;
 
@@ -35,21 +41,77 @@ using namespace std;
 #define HASHOP_MEMADDHASHPREV 15
 #define HASHOP_MEMXORHASHPREV 16
 #define HASHOP_SUMBLOCK 17
+#define HASHOP_MEMADDXOR 18		//memgen row = (row + a) ^ b, only emitted by cProgramOptimizer
+#define HASHOP_MEMGEN_PARTIAL 19	//MEMGEN size, rows - only the first rows are generated, only emitted by cProgramOptimizer
+
+//Per-thread scratch state for the scalar CPU engine.  Allocated once when the thread starts,
+//so running a hash never touches the heap.
+class cMinerScratch
+{
+public:
+	//the C++11 operator new does not honour alignas
+	static void* operator new(size_t size) { return MemRowsAlloc(size); }
+	static void operator delete(void* ptr) { MemRowsFree(ptr); }
+
+	alignas(MEMGEN_ALIGN) uint32_t memGen[512 * 8];
+	uint32_t tempStore[8];
+	cMemTransforms pending;		//memgen updates not yet applied to the rows - cThreadedVM only
+};
+
+#define PIPELINE_NONCES 4		//nonces each pipelined CPU thread keeps in flight
+
+//A nonce in flight in the pipelined CPU engine
+class cPipelineSlot
+{
+public:
+	static void* operator new[](size_t size) { return MemRowsAlloc(size); }
+	static void operator delete[](void* ptr) { MemRowsFree(ptr); }
+
+	uint32_t nonce;
+	uint32_t hash[8];
+	sThreadedResume resume;
+	cMinerScratch scratch;
+};
+
+#define GPU_PIPELINE_DEPTH 3		//kernel batches each GPU keeps queued
+#define GPU_BATCH_GROWTH 2			//-gpubatchms grows a batch to at most this many times the configured work items
+
+//A GPU batch in flight
+class cGPUBatch
+{
+public:
+	uint32_t nonce;				//lease the batch hashes
+	uint32_t count;
+	size_t globalSize;			//work items
+	cl_event kernelDone;		//the kernel, its status for the abort and its profiling times for -gpubatchms
+	cl_mem nonceBuffer;			//NonceRetBuf of this batch
+	cl_mem pinnedBuffer;		//page locked host memory, mapped at results
+	uint32_t* results;
+	uint32_t* coverage;			//first nonce and count each work item hashed, -nonceaudit only
+	cl_event done;				//results have been read back
+};
 
 class cMiner
 {
 public:
 	void startMiner(string params, cGetWork *getWork, cSubmitter* submitter, cStatDisplay* statDisplay, uint32_t GPUIndex, unsigned char* hashBlock);
 	void startGPUMiner(const size_t computeUnits, int platformID, int deviceID, cGetWork *getWork, cSubmitter* submitter, cStatDisplay *statDisplay, size_t gpuWorkSize, uint32_t GPUIndex, int gpuLoops, unsigned char* hashBlock);
-	void startCPUMiner(cGetWork* getWork, cSubmitter* submitter, cStatDisplay* statDisplay, int cpuIndex, unsigned int startNonce, unsigned char* hashBlock);
-	void runProgram(unsigned char* header, std::vector<unsigned int> program, unsigned int* hash, CSHA256 _sha256, unsigned char* hashBlock);
+	void startCPUMiner(cGetWork* getWork, cSubmitter* submitter, cStatDisplay* statDisplay, int cpuIndex, unsigned char* hashBlock, uint32_t lanes, int pinCpu, int node);
+	void runProgram(const cPreparedJob* job, uint32_t nonce, unsigned int* hash, cMinerScratch* scratch, const unsigned char* hashBlock);
 	vector<string> split(string str, string token);
-	cl_program loadMiner(cl_context context, cl_device_id* deviceID, int gpuLoops);
+	cl_program loadMiner(cl_context context, cl_device_id* deviceID, int gpuLoops, bool required = true);
 
 	cl_kernel kernel;
 	cl_command_queue commandQueue;
 
 	bool pause;
+	bool benchmark;			//benchmark mode - no pool, CPU threads verify the hash loop does not allocate
+	string cpuEngine;		//single lane CPU engine - jit, threaded (pre-decoded), pipelined or legacy
+	cTopology* topology;	//where CPU threads are pinned and which hash block copy they read
+	cNonceAudit* audit;		//-nonceaudit, NULL when off
+	bool tune;				//-tune on, GPU miners are tuned before they start
+	string gpuProfile;		//tuned GPU settings per device name and driver version
+	uint32_t batchTargetMs;	//-gpubatchms, kernel time GPU batches are sized for, 0 keeps the configured size
 
 
 
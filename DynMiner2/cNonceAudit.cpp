@@ -0,0 +1,187 @@
+#include "cNonceAudit.h"
+#include "cGetWork.h"
+#include "cStatDisplay.h"
+#include <stdio.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+
+
+cAuditWorker::cAuditWorker() {
+	openCount = 0;
+	head = 0;
+	tail = 0;
+	flushRequest = false;
+	dropped = 0;
+	hashed = 0;
+	duplicate = 0;
+}
+
+
+//move open run index to the ring
+void cAuditWorker::evict(uint32_t index) {
+	uint32_t h = head.load(memory_order_relaxed);
+	if (h - tail.load(memory_order_acquire) < AUDIT_RING_SIZE) {
+		ring[h % AUDIT_RING_SIZE] = open[index];
+		head.store(h + 1, memory_order_release);
+	}
+	else
+		dropped++;
+
+	openCount--;
+	for (uint32_t i = index; i < openCount; i++)
+		open[i] = open[i + 1];
+}
+
+
+void cAuditWorker::flush() {
+	while (openCount > 0)
+		evict(0);
+	flushRequest.store(false, memory_order_release);
+}
+
+
+uint64_t cJobCoverage::add(uint64_t first, uint64_t end) {
+
+	uint64_t overlap = 0;
+
+	//first interval that can touch [first, end) is the one starting at or before it
+	map<uint64_t, uint64_t>::iterator it = intervals.upper_bound(first);
+	if (it != intervals.begin())
+		it--;
+
+	while ((it != intervals.end()) && (it->first <= end)) {
+		if (it->second < first) {
+			it++;
+			continue;
+		}
+		if ((it->first < end) && (it->second > first))
+			overlap += min(end, it->second) - max(first, it->first);
+		first = min(first, it->first);
+		end = max(end, it->second);
+		it = intervals.erase(it);
+	}
+	intervals[first] = end;
+
+	return overlap;
+}
+
+
+cNonceAudit::cNonceAudit() {
+	hashed = 0;
+	unique = 0;
+	finishedJobs = 0;
+	gaps = 0;
+	gapNonces = 0;
+}
+
+
+cAuditWorker* cNonceAudit::addWorker(const string& name) {
+	cAuditWorker* worker = new cAuditWorker();
+	worker->name = name;
+
+	lock_guard<mutex> lock(workerLock);
+	workers.push_back(worker);
+	return worker;
+}
+
+
+//Drain the workers' rings into the per job coverage.  Jobs older than finishedBefore are done,
+//their gaps are counted and their intervals dropped.
+void cNonceAudit::collect(uint32_t finishedBefore) {
+
+	lock_guard<mutex> lock(workerLock);
+
+	for (size_t w = 0; w < workers.size(); w++) {
+		cAuditWorker* worker = workers[w];
+		uint32_t h = worker->head.load(memory_order_acquire);
+		for (uint32_t t = worker->tail.load(memory_order_relaxed); t != h; t++) {
+			const sNonceRun& run = worker->ring[t % AUDIT_RING_SIZE];
+			cJobCoverage& job = jobs[run.job];
+			uint64_t overlap = job.add(run.first, (uint64_t)run.first + run.count);
+
+			job.hashed += run.count;
+			job.duplicate += overlap;
+			worker->hashed += run.count;
+			worker->duplicate += overlap;
+			hashed += run.count;
+			unique += run.count - overlap;
+		}
+		worker->tail.store(h, memory_order_release);
+	}
+
+	//a gap is any hole below the highest nonce hashed, leases the workers dropped at a job switch included
+	for (map<uint64_t, cJobCoverage>::iterator it = jobs.begin(); (it != jobs.end()) && ((it->first >> 32) < finishedBefore); ) {
+		const map<uint64_t, uint64_t>& intervals = it->second.intervals;
+		uint64_t end = 0;
+		for (map<uint64_t, uint64_t>::const_iterator i = intervals.begin(); i != intervals.end(); i++) {
+			if (i->first > end) {
+				gaps++;
+				gapNonces += i->first - end;
+			}
+			end = i->second;
+		}
+		finishedJobs++;
+		it = jobs.erase(it);
+	}
+}
+
+
+void cNonceAudit::reportThread(cGetWork* getWork, cStatDisplay* statDisplay) {
+
+	time_t start;
+	time(&start);
+
+	//jobs replaced before the previous report have had a whole flush cycle to come in
+	uint32_t finishedBefore = 0;
+
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::seconds(AUDIT_REPORT_SECONDS));
+
+		//the runs the workers are still growing, a hashing worker hands them over within a batch
+		vector<cAuditWorker*> flushing;
+		{
+			lock_guard<mutex> lock(workerLock);
+			flushing = workers;
+		}
+		for (size_t w = 0; w < flushing.size(); w++)
+			flushing[w]->flushRequest = true;
+
+		chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(AUDIT_FLUSH_MS);
+		while (true) {
+			bool pending = false;
+			for (size_t w = 0; w < flushing.size(); w++)
+				pending |= flushing[w]->flushRequest.load(memory_order_acquire);
+			if (!pending || (chrono::steady_clock::now() >= deadline))
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		//an idle or stalled worker keeps its open runs, they come in with a later report
+		for (size_t w = 0; w < flushing.size(); w++)
+			if (flushing[w]->flushRequest.load(memory_order_acquire))
+				printf("Nonce audit: %s did not hand over its open runs within %d ms\n", flushing[w]->name.c_str(), AUDIT_FLUSH_MS);
+
+		collect(finishedBefore);
+		finishedBefore = getWork->workID;
+
+		time_t now;
+		time(&now);
+		double seconds = (double)(now - start);
+		double reported = (double)statDisplay->collectHashes() / seconds;
+
+		printf("Nonce audit: %llu hashed, %.3f%% duplicate, %llu gaps (%llu nonces) in %u finished jobs, unique %.2f KH/s of %.2f KH/s reported\n",
+			(unsigned long long)hashed, (hashed == 0) ? 0.0 : 100.0 * (hashed - unique) / hashed,
+			(unsigned long long)gaps, (unsigned long long)gapNonces, finishedJobs,
+			(double)unique / seconds / 1024, reported / 1024);
+
+		lock_guard<mutex> lock(workerLock);
+		for (size_t w = 0; w < workers.size(); w++) {
+			cAuditWorker* worker = workers[w];
+			printf("  %s: %llu hashed, %llu duplicate", worker->name.c_str(), (unsigned long long)worker->hashed, (unsigned long long)worker->duplicate);
+			if (worker->dropped > 0)
+				printf(", %llu runs dropped - the ring was full", (unsigned long long)worker->dropped.load());
+			printf("\n");
+		}
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <string>
+#include <vector>
+
+class cGetWork;
+class cStatDisplay;
+
+using namespace std;
+
+#define AUDIT_RING_SIZE 8192		//runs a worker can hand over between two reports
+#define AUDIT_OPEN_RUNS 8			//runs a worker keeps growing before they go in the ring, enough for the pipelined engine's out of order nonces
+#define AUDIT_REPORT_SECONDS 10
+#define AUDIT_FLUSH_MS 2000			//longest the report waits for the workers to hand over their open runs
+
+//Audit key of a job, its work generation and ntime.  A rolled job starts its nonces at 0 again
+//for the next ntime, so it must never be merged with the job it replaced.
+inline uint64_t auditJobKey(uint32_t workID, const unsigned char* header) {
+	uint32_t ntime;
+	memcpy(&ntime, header + 68, 4);
+	return ((uint64_t)workID << 32) | ntime;
+}
+
+//A run of consecutive nonces one worker hashed for one job
+struct sNonceRun
+{
+	uint64_t job;							//auditJobKey
+	uint32_t first;
+	uint32_t count;
+};
+
+//What one worker hashed.  The worker merges each nonce it finishes into a few open runs and
+//hands finished runs to the report thread through a single producer ring, so recording never
+//locks or touches the heap.
+class cAuditWorker
+{
+public:
+	cAuditWorker();
+
+	inline void record(uint64_t job, uint32_t nonce, uint32_t count) {
+		if (flushRequest.load(memory_order_relaxed))
+			flush();
+
+		for (uint32_t i = 0; i < openCount; i++) {
+			sNonceRun& run = open[i];
+			if ((run.job != job) || (run.count > 0x7FFFFFFF))
+				continue;
+			if ((uint64_t)run.first + run.count == nonce) {
+				run.count += count;
+				return;
+			}
+			if ((uint64_t)nonce + count == run.first) {
+				run.first = nonce;
+				run.count += count;
+				return;
+			}
+		}
+
+		if (openCount == AUDIT_OPEN_RUNS)
+			evict(0);
+		open[openCount].job = job;
+		open[openCount].first = nonce;
+		open[openCount].count = count;
+		openCount++;
+	}
+
+	void flush();
+	void evict(uint32_t index);
+
+	string name;
+	sNonceRun open[AUDIT_OPEN_RUNS];
+	uint32_t openCount;
+	sNonceRun ring[AUDIT_RING_SIZE];
+	atomic<uint32_t> head;					//written by the worker
+	atomic<uint32_t> tail;					//written by the report thread
+	atomic<bool> flushRequest;				//report thread wants the open runs, the worker clears it once they are in the ring
+	atomic<uint64_t> dropped;				//runs lost to a full ring
+
+	uint64_t hashed;						//report thread totals
+	uint64_t duplicate;
+};
+
+//Nonces of one job every worker hashed, as disjoint [first, end) intervals
+class cJobCoverage
+{
+public:
+	cJobCoverage() : hashed(0), duplicate(0) {}
+
+	//returns how many nonces of [first, end) were already covered
+	uint64_t add(uint64_t first, uint64_t end);
+
+	map<uint64_t, uint64_t> intervals;
+	uint64_t hashed;
+	uint64_t duplicate;
+};
+
+//-nonceaudit on: checks that the CPU and GPU workers hash every nonce of a job once.  Reports
+//the nonces hashed more than once, the gaps left in finished jobs and the hashrate that is left
+//when only unique nonces count.
+class cNonceAudit
+{
+public:
+	cNonceAudit();
+
+	//call before the hash loop, the worker keeps the pointer
+	cAuditWorker* addWorker(const string& name);
+
+	void reportThread(cGetWork* getWork, cStatDisplay* statDisplay);
+	void collect(uint32_t finishedBefore);
+
+	mutex workerLock;
+	vector<cAuditWorker*> workers;
+	map<uint64_t, cJobCoverage> jobs;		//by auditJobKey, jobs still being mined or not yet reported
+
+	uint64_t hashed;
+	uint64_t unique;
+	uint32_t finishedJobs;
+	uint64_t gaps;
+	uint64_t gapNonces;
+};
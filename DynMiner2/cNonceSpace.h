@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+#define NONCE_SPACE_SIZE 0x100000000ULL
+#define NONCE_LEASE_MS 100				//CPU leases are sized to last about this long
+#define NONCE_LEASE_MAX (1 << 24)
+
+//The 2^32 nonces of one job.  Every CPU and GPU worker leases its next run of nonces here with
+//a single fetch_add, so no nonce of a job is hashed twice.  The counter is 64 bit so running
+//past the last nonce shows up as exhaustion instead of wrapping back to 0.
+class cNonceSpace
+{
+public:
+	cNonceSpace() : next(0) {}
+	cNonceSpace(const cNonceSpace&) : next(0) {}		//a copied job starts with all its nonces
+
+	//want nonces from first, false when the job has none left.  Only the last lease can be short.
+	bool lease(uint32_t want, uint32_t& first, uint32_t& count) {
+		uint64_t start = next.fetch_add(want, memory_order_relaxed);
+		if (start >= NONCE_SPACE_SIZE)
+			return false;
+		first = (uint32_t)start;
+		count = (uint32_t)min<uint64_t>(want, NONCE_SPACE_SIZE - start);
+		return true;
+	}
+
+	atomic<uint64_t> next;
+};
+
+//A CPU thread's current lease.  Each new lease is sized from the rate the previous one was
+//hashed at, a multiple of granularity (the lane count) between granularity and NONCE_LEASE_MAX.
+class cNonceLease
+{
+public:
+	cNonceLease(uint32_t granularity) : nonce(0), left(0), granularity(granularity), size(granularity), leased(0) {}
+
+	//new job - the rate of the lease that was cut short is not measured
+	bool begin(cNonceSpace& space) {
+		leased = 0;
+		return refill(space);
+	}
+
+	//the current lease is used up
+	bool refill(cNonceSpace& space) {
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (leased > 0) {
+			double ms = chrono::duration<double, milli>(now - started).count();
+			double want = (ms > 0) ? leased * NONCE_LEASE_MS / ms : (double)NONCE_LEASE_MAX;
+			want = min(max(want, (double)granularity), (double)NONCE_LEASE_MAX);
+			size = (uint32_t)want / granularity * granularity;
+		}
+
+		if (!space.lease(size, nonce, left))
+			return false;
+		leased = left;
+		started = now;
+		return true;
+	}
+
+	uint32_t nonce;			//next nonce to hash
+	uint32_t left;			//nonces left in the lease, from nonce
+	uint32_t granularity;
+	uint32_t size;			//next lease
+	uint32_t leased;		//size of the current lease, 0 when its rate is not measured
+	chrono::steady_clock::time_point started;
+};
@@ -0,0 +1,790 @@
+#include "cProgramJIT.h"
+#include "cMiner.h"
+#include "cGetWork.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PROGRAM_JIT
+#include <sys/mman.h>
+#endif
+
+bool cProgramJIT::enabled = false;
+bool cProgramJIT::inlineShani = false;
+map<uint64_t, shared_ptr<cProgramJIT>> cProgramJIT::cache;
+
+#define JIT_CACHE_SIZE 16		//compiled programs kept once no job uses them any more
+
+
+cProgramJIT::cProgramJIT() {
+	function = NULL;
+	memory = NULL;
+	memorySize = 0;
+	codeSize = 0;
+}
+
+cProgramJIT::~cProgramJIT() {
+#ifdef PROGRAM_JIT
+	if (memory != NULL)
+		munmap(memory, memorySize);
+#endif
+}
+
+
+void cProgramJIT::runProgram(const cPreparedJob* job, uint32_t nonce, uint32_t* hash, cMinerScratch* scratch, const unsigned char* hashBlock) const {
+
+	unsigned char tail[16];
+	memcpy(tail, &job->header[64], 12);
+	memcpy(&tail[12], &nonce, 4);
+	SHA256_80_Tail((unsigned char*)hash, job->midstate, tail);
+
+	function(hash, scratch->memGen, scratch->tempStore, job->prevHashSHA, hashBlock);
+}
+
+
+#ifdef PROGRAM_JIT
+
+namespace {
+
+//general purpose registers
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15 };
+
+//Register use in the generated code:
+//  xmm8/xmm9   hash words 0-3 / 4-7
+//  xmm0-xmm7   SHA-256 (xmm0 is the implicit round constant operand of sha256rnds2)
+//  xmm10-15    scratch
+//  rbx hashBlock, rbp memgen size, r12 hash, r13 memGen, r14 tempStore, r15 prevHashSHA
+//  [rsp] loop start address, [rsp+8] loop count, [rsp+12] SHA loop count,
+//  [rsp+16] memgen row pointer, [rsp+24] memgen rows left
+#define HASH_LO 8
+#define HASH_HI 9
+
+#define SLOT_LOOP_START 0
+#define SLOT_LOOP_COUNT 8
+#define SLOT_SHA_COUNT 12
+#define SLOT_ROW_PTR 16
+#define SLOT_ROWS_LEFT 24
+#define FRAME_SIZE 40
+
+#define SHA_UNROLL 16			//SHA2 n loops up to this count are fully unrolled
+
+static const uint32_t jitOpWords[HASHOP_MEMGEN_PARTIAL + 1] = { 9, 9, 1, 2, 2, 9, 9, 2, 1, 3, 2, 1, 3, 1, 2, 1, 1, 1, 17, 3 };
+
+static const uint8_t shaMask[16] = { 0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c };
+static const uint8_t shaInit0[16] = { 0x8c, 0x68, 0x05, 0x9b, 0x7f, 0x52, 0x0e, 0x51, 0x85, 0xae, 0x67, 0xbb, 0x67, 0xe6, 0x09, 0x6a };
+static const uint8_t shaInit1[16] = { 0x19, 0xcd, 0xe0, 0x5b, 0xab, 0xd9, 0x83, 0x1f, 0x3a, 0xf5, 0x4f, 0xa5, 0x72, 0xf3, 0x6e, 0x3c };
+
+//SUMBLOCK for an index whose 256 bytes wrap around the end of the hash block
+void jitSumBlockWrap(uint32_t* hash, const unsigned char* hashBlock, uint64_t index) {
+	const uint64_t hashBlockSize = 1024ULL * 1024ULL * 3072ULL;
+	for (int i = 0; i < 256; i++)
+		hash[i % 8] += hashBlock[(index + i) % hashBlockSize];
+}
+
+void jitSha256(uint32_t* hash) {
+	SHA256_32((unsigned char*)hash, (unsigned char*)hash);
+}
+
+
+//Byte level x86-64 assembler for the handful of instructions the programs need.  Jumps go to
+//labels and constants to a 16 byte aligned pool after the code, both are patched in finish().
+class cEmitter
+{
+public:
+	vector<uint8_t> code;
+	vector<uint8_t> pool;
+	vector<int64_t> labels;
+	vector<pair<size_t, int>> labelFixups;		//rel32 position, label
+	vector<pair<size_t, size_t>> poolFixups;	//rel32 position, pool offset
+
+	int newLabel() { labels.push_back(-1); return labels.size() - 1; }
+	void bind(int label) { labels[label] = code.size(); }
+
+	void b(uint8_t v) { code.push_back(v); }
+	void d(uint32_t v) { for (int i = 0; i < 4; i++) b(v >> (i * 8)); }
+	void q(uint64_t v) { for (int i = 0; i < 8; i++) b(v >> (i * 8)); }
+
+	size_t constant(const void* data) {
+		size_t offset = pool.size();
+		pool.insert(pool.end(), (const uint8_t*)data, (const uint8_t*)data + 16);
+		return offset;
+	}
+	size_t constant(uint64_t lo, uint64_t hi) {
+		uint64_t v[2] = { lo, hi };
+		return constant(v);
+	}
+
+	void rex(bool w, int reg, int index, int base, bool force = false) {
+		uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+		if (force || (r != 0x40))
+			b(r);
+	}
+	void modrm(int mod, int reg, int rm) { b((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+	//[base + disp32]
+	void mem(int reg, int base, int32_t disp) {
+		modrm(2, reg, base);
+		if ((base & 7) == RSP)
+			b(0x24);
+		d(disp);
+	}
+
+	//SSE register/register and register/memory forms, prefix is 0x66, 0xF3 or 0 for none
+	void sseOp(uint8_t prefix, const char* op, int len, int reg, int rm) {
+		if (prefix) b(prefix);
+		rex(false, reg, 0, rm);
+		for (int i = 0; i < len; i++) b(op[i]);
+		modrm(3, reg, rm);
+	}
+	void sseMem(uint8_t prefix, const char* op, int len, int reg, int base, int32_t disp) {
+		if (prefix) b(prefix);
+		rex(false, reg, 0, base);
+		for (int i = 0; i < len; i++) b(op[i]);
+		mem(reg, base, disp);
+	}
+	void ssePool(uint8_t prefix, const char* op, int len, int reg, size_t offset) {
+		if (prefix) b(prefix);
+		rex(false, reg, 0, 0);
+		for (int i = 0; i < len; i++) b(op[i]);
+		modrm(0, reg, 5);
+		poolFixups.push_back(make_pair(code.size(), offset));
+		d(0);
+	}
+
+	void movdqa(int dst, int src) { sseOp(0x66, "\x0f\x6f", 2, dst, src); }
+	void movdqaPool(int dst, size_t c) { ssePool(0x66, "\x0f\x6f", 2, dst, c); }
+	void movdquLoad(int dst, int base, int32_t disp) { sseMem(0xF3, "\x0f\x6f", 2, dst, base, disp); }
+	void movdquStore(int base, int32_t disp, int src) { sseMem(0xF3, "\x0f\x7f", 2, src, base, disp); }
+	void paddd(int dst, int src) { sseOp(0x66, "\x0f\xfe", 2, dst, src); }
+	void padddPool(int dst, size_t c) { ssePool(0x66, "\x0f\xfe", 2, dst, c); }
+	void paddw(int dst, int src) { sseOp(0x66, "\x0f\xfd", 2, dst, src); }
+	void pxor(int dst, int src) { sseOp(0x66, "\x0f\xef", 2, dst, src); }
+	void pxorPool(int dst, size_t c) { ssePool(0x66, "\x0f\xef", 2, dst, c); }
+	void punpcklbw(int dst, int src) { sseOp(0x66, "\x0f\x60", 2, dst, src); }
+	void punpckhbw(int dst, int src) { sseOp(0x66, "\x0f\x68", 2, dst, src); }
+	void punpcklwd(int dst, int src) { sseOp(0x66, "\x0f\x61", 2, dst, src); }
+	void punpckhwd(int dst, int src) { sseOp(0x66, "\x0f\x69", 2, dst, src); }
+	void pshufd(int dst, int src, uint8_t imm) { sseOp(0x66, "\x0f\x70", 2, dst, src); b(imm); }
+	void pshufbPool(int dst, size_t c) { ssePool(0x66, "\x0f\x38\x00", 3, dst, c); }
+	void palignr(int dst, int src, uint8_t imm) { sseOp(0x66, "\x0f\x3a\x0f", 3, dst, src); b(imm); }
+	void pblendw(int dst, int src, uint8_t imm) { sseOp(0x66, "\x0f\x3a\x0e", 3, dst, src); b(imm); }
+	void sha256rnds2(int dst, int src) { sseOp(0, "\x0f\x38\xcb", 3, dst, src); }
+	void sha256msg1(int dst, int src) { sseOp(0, "\x0f\x38\xcc", 3, dst, src); }
+	void sha256msg2(int dst, int src) { sseOp(0, "\x0f\x38\xcd", 3, dst, src); }
+	void movdToGpr(int dst, int xmm) { sseOp(0x66, "\x0f\x7e", 2, xmm, dst); }
+
+	void push(int r) { rex(false, 0, 0, r); b(0x50 + (r & 7)); }
+	void pop(int r) { rex(false, 0, 0, r); b(0x58 + (r & 7)); }
+	void movRR(int dst, int src) { rex(true, src, 0, dst); b(0x89); modrm(3, src, dst); }
+	void movRI32(int dst, uint32_t v) { rex(false, 0, 0, dst); b(0xB8 + (dst & 7)); d(v); }
+	void movRI64(int dst, uint64_t v) { rex(true, 0, 0, dst); b(0xB8 + (dst & 7)); q(v); }
+	void xorRR32(int dst, int src) { rex(false, src, 0, dst); b(0x31); modrm(3, src, dst); }
+	void addRR(int dst, int src) { rex(true, src, 0, dst); b(0x01); modrm(3, src, dst); }
+	void addRI8(int dst, int8_t v) { rex(true, 0, 0, dst); b(0x83); modrm(3, 0, dst); b(v); }
+	void subRI8(int dst, int8_t v) { rex(true, 0, 0, dst); b(0x83); modrm(3, 5, dst); b(v); }
+	void andRI32(int dst, uint32_t v) { rex(false, 0, 0, dst); b(0x81); modrm(3, 4, dst); d(v); }
+	void cmpRR(int a, int bReg) { rex(true, bReg, 0, a); b(0x39); modrm(3, bReg, a); }
+	void cmpRI8_32(int a, int8_t v) { rex(false, 0, 0, a); b(0x83); modrm(3, 7, a); b(v); }
+	void testRR32(int a, int bReg) { rex(false, bReg, 0, a); b(0x85); modrm(3, bReg, a); }
+	void incR32(int r) { rex(false, 0, 0, r); b(0xFF); modrm(3, 0, r); }
+	void decR32(int r) { rex(false, 0, 0, r); b(0xFF); modrm(3, 1, r); }
+	void divR32(int r) { rex(false, 0, 0, r); b(0xF7); modrm(3, 6, r); }
+	void shlRI(int r, uint8_t v) { rex(true, 0, 0, r); b(0xC1); modrm(3, 4, r); b(v); }
+	void callR(int r) { rex(false, 0, 0, r); b(0xFF); modrm(3, 2, r); }
+	void ret() { b(0xC3); }
+
+	//[rsp + disp8] stack slots
+	void slot(int reg, int disp) { modrm(1, reg, RSP); b(0x24); b(disp); }
+	void storeSlot64(int disp, int r) { rex(true, r, 0, 0); b(0x89); slot(r, disp); }
+	void loadSlot64(int r, int disp) { rex(true, r, 0, 0); b(0x8B); slot(r, disp); }
+	void storeSlot32(int disp, int r) { rex(false, r, 0, 0); b(0x89); slot(r, disp); }
+	void storeSlotI32(int disp, uint32_t v) { b(0xC7); slot(0, disp); d(v); }
+	void decSlot32(int disp) { b(0xFF); slot(1, disp); }
+	void jmpSlot(int disp) { b(0xFF); slot(4, disp); }
+
+	void leaLabel(int r, int label) {
+		rex(true, r, 0, 0);
+		b(0x8D);
+		modrm(0, r, 5);
+		labelFixups.push_back(make_pair(code.size(), label));
+		d(0);
+	}
+	void jmp(int label) { b(0xE9); labelFixups.push_back(make_pair(code.size(), label)); d(0); }
+	void jcc(uint8_t cc, int label) { b(0x0F); b(0x80 | cc); labelFixups.push_back(make_pair(code.size(), label)); d(0); }
+	void je(int label) { jcc(0x4, label); }
+	void jne(int label) { jcc(0x5, label); }
+	void ja(int label) { jcc(0x7, label); }
+
+	//lay the pool out after the code and resolve every displacement, returns the image size
+	size_t finish() {
+		while (code.size() % 16)
+			b(0xCC);
+		size_t poolStart = code.size();
+		for (size_t i = 0; i < labelFixups.size(); i++) {
+			size_t at = labelFixups[i].first;
+			int32_t rel = (int32_t)(labels[labelFixups[i].second] - (int64_t)(at + 4));
+			memcpy(&code[at], &rel, 4);
+		}
+		for (size_t i = 0; i < poolFixups.size(); i++) {
+			size_t at = poolFixups[i].first;
+			int32_t rel = (int32_t)(poolStart + poolFixups[i].second - (at + 4));
+			memcpy(&code[at], &rel, 4);
+		}
+		code.insert(code.end(), pool.begin(), pool.end());
+		return code.size();
+	}
+};
+
+
+class cCompiler
+{
+public:
+	cEmitter e;
+	size_t mask, init0, init1, pad0, pad1;
+
+	cCompiler() {
+		mask = e.constant(shaMask);
+		init0 = e.constant(shaInit0);
+		init1 = e.constant(shaInit1);
+		pad0 = e.constant(0x80000000ULL, 0);
+		pad1 = e.constant(0, 0x10000000000ULL);
+	}
+
+	void quadRound(int msg, uint64_t k1, uint64_t k0) {
+		if (msg >= 0) {
+			e.movdqa(0, msg);
+			e.padddPool(0, e.constant(k0, k1));
+		}
+		else
+			e.movdqaPool(0, e.constant(k0, k1));
+		e.sha256rnds2(2, 1);
+		e.pshufd(0, 0, 0x0e);
+		e.sha256rnds2(1, 2);
+	}
+
+	void shiftA(int m0, int m1) { e.sha256msg1(m0, m1); }
+	void shiftC(int m0, int m1, int m2) {
+		e.movdqa(7, m1);
+		e.palignr(7, m0, 4);
+		e.paddd(m2, 7);
+		e.sha256msg2(m2, m1);
+	}
+	void shiftB(int m0, int m1, int m2) { shiftC(m0, m1, m2); shiftA(m0, m1); }
+
+	//hash = SHA-256(hash) - same sequence as sha256_shani::Transform32, state in xmm1/xmm2,
+	//message in xmm3-xmm6
+	void sha() {
+		if (!cProgramJIT::inlineShani) {
+			e.movdquStore(R12, 0, HASH_LO);
+			e.movdquStore(R12, 16, HASH_HI);
+			e.movRR(RDI, R12);
+			e.movRI64(RAX, (uint64_t)&jitSha256);
+			e.callR(RAX);
+			e.movdquLoad(HASH_LO, R12, 0);
+			e.movdquLoad(HASH_HI, R12, 16);
+			return;
+		}
+
+		e.movdqaPool(1, init0);
+		e.movdqaPool(2, init1);
+
+		e.movdqa(3, HASH_LO);
+		e.pshufbPool(3, mask);
+		quadRound(3, 0xe9b5dba5b5c0fbcfull, 0x71374491428a2f98ull);
+		e.movdqa(4, HASH_HI);
+		e.pshufbPool(4, mask);
+		quadRound(4, 0xab1c5ed5923f82a4ull, 0x59f111f13956c25bull);
+		shiftA(3, 4);
+		e.movdqaPool(5, pad0);
+		quadRound(-1, 0x550c7dc3243185beull, 0x12835b015807aa98ull);
+		shiftA(4, 5);
+		e.movdqaPool(6, pad1);
+		quadRound(-1, 0xc19bf2749bdc06a7ull, 0x80deb1fe72be5d74ull);
+		shiftB(5, 6, 3);
+		quadRound(3, 0x240ca1cc0fc19dc6ull, 0xefbe4786e49b69c1ull);
+		shiftB(6, 3, 4);
+		quadRound(4, 0x76f988da5cb0a9dcull, 0x4a7484aa2de92c6full);
+		shiftB(3, 4, 5);
+		quadRound(5, 0xbf597fc7b00327c8ull, 0xa831c66d983e5152ull);
+		shiftB(4, 5, 6);
+		quadRound(6, 0x1429296706ca6351ull, 0xd5a79147c6e00bf3ull);
+		shiftB(5, 6, 3);
+		quadRound(3, 0x53380d134d2c6dfcull, 0x2e1b213827b70a85ull);
+		shiftB(6, 3, 4);
+		quadRound(4, 0x92722c8581c2c92eull, 0x766a0abb650a7354ull);
+		shiftB(3, 4, 5);
+		quadRound(5, 0xc76c51a3c24b8b70ull, 0xa81a664ba2bfe8a1ull);
+		shiftB(4, 5, 6);
+		quadRound(6, 0x106aa070f40e3585ull, 0xd6990624d192e819ull);
+		shiftB(5, 6, 3);
+		quadRound(3, 0x34b0bcb52748774cull, 0x1e376c0819a4c116ull);
+		shiftB(6, 3, 4);
+		quadRound(4, 0x682e6ff35b9cca4full, 0x4ed8aa4a391c0cb3ull);
+		shiftC(3, 4, 5);
+		quadRound(5, 0x8cc7020884c87814ull, 0x78a5636f748f82eeull);
+		shiftC(4, 5, 6);
+		quadRound(6, 0xc67178f2bef9a3f7ull, 0xa4506ceb90befffaull);
+
+		e.padddPool(1, init0);
+		e.padddPool(2, init1);
+
+		//Unshuffle, then back to native word order
+		e.pshufd(7, 1, 0x1B);
+		e.pshufd(0, 2, 0xB1);
+		e.movdqa(HASH_LO, 7);
+		e.pblendw(HASH_LO, 0, 0xF0);
+		e.movdqa(HASH_HI, 0);
+		e.palignr(HASH_HI, 7, 8);
+		e.pshufbPool(HASH_LO, mask);
+		e.pshufbPool(HASH_HI, mask);
+	}
+
+	//eax = sum of the 4 words in xmm src
+	void sum4(int src, int dst) {
+		e.pshufd(10, src, 0x4E);
+		e.paddd(10, src);
+		e.pshufd(11, 10, 0xB1);
+		e.paddd(10, 11);
+		e.movdToGpr(dst, 10);
+	}
+
+	//eax = sum of the 8 hash words
+	void sum8() {
+		e.movdqa(12, HASH_LO);
+		e.paddd(12, HASH_HI);
+		sum4(12, RAX);
+	}
+
+	//hash = memGen[edx], edx = row
+	void loadRow() {
+		e.shlRI(RDX, 5);
+		e.addRR(RDX, R13);
+		e.movdquLoad(HASH_LO, RDX, 0);
+		e.movdquLoad(HASH_HI, RDX, 16);
+	}
+
+	//apply xmm10/xmm11 to every memgen row, xor or add, optionally adding the hash first and
+	//xoring xmm14/xmm15 after
+	void memRows(bool add, bool addHash, bool thenXor = false) {
+		int done = e.newLabel();
+		int loop = e.newLabel();
+		e.movRR(RAX, R13);
+		e.movRR(RCX, RBP);
+		e.testRR32(RCX, RCX);
+		e.je(done);
+		e.bind(loop);
+		for (int half = 0; half < 2; half++) {
+			int v = 12 + half;
+			e.movdquLoad(v, RAX, half * 16);
+			if (addHash)
+				e.paddd(v, half ? HASH_HI : HASH_LO);
+			if (add)
+				e.paddd(v, 10 + half);
+			else
+				e.pxor(v, 10 + half);
+			if (thenXor)
+				e.pxor(v, 14 + half);
+			e.movdquStore(RAX, half * 16, v);
+		}
+		e.addRI8(RAX, 32);
+		e.decR32(RCX);
+		e.jne(loop);
+		e.bind(done);
+	}
+
+	void sumBlock() {
+		int wrap = e.newLabel();
+		int done = e.newLabel();
+
+		sum4(HASH_HI, RCX);
+		e.andRI32(RCX, 32767);
+		sum4(HASH_LO, RAX);
+		e.movRI32(R11, 3072);
+		e.xorRR32(RDX, RDX);
+		e.divR32(R11);
+		e.shlRI(RDX, 15);
+		e.addRR(RDX, RCX);			//rdx = index
+		e.movRI64(RAX, 1024ULL * 1024ULL * 3072ULL - 256);
+		e.cmpRR(RDX, RAX);
+		e.ja(wrap);
+
+		//per byte column sums of 16 rows of 16 bytes fit in 16 bits
+		e.movRR(RAX, RBX);
+		e.addRR(RAX, RDX);
+		e.pxor(15, 15);
+		e.pxor(12, 12);
+		e.pxor(13, 13);
+		for (int k = 0; k < 16; k++) {
+			e.movdquLoad(10, RAX, k * 16);
+			e.movdqa(11, 10);
+			e.punpcklbw(10, 15);
+			e.punpckhbw(11, 15);
+			e.paddw(12, 10);
+			e.paddw(13, 11);
+		}
+		e.paddw(12, 13);
+		e.movdqa(10, 12);
+		e.punpcklwd(10, 15);
+		e.punpckhwd(12, 15);
+		e.paddd(HASH_LO, 10);
+		e.paddd(HASH_HI, 12);
+		e.jmp(done);
+
+		e.bind(wrap);
+		e.movdquStore(R12, 0, HASH_LO);
+		e.movdquStore(R12, 16, HASH_HI);
+		e.movRR(RDI, R12);
+		e.movRR(RSI, RBX);
+		e.movRI64(RAX, (uint64_t)&jitSumBlockWrap);
+		e.callR(RAX);
+		e.movdquLoad(HASH_LO, R12, 0);
+		e.movdquLoad(HASH_HI, R12, 16);
+		e.bind(done);
+	}
+
+	bool compile(const vector<uint32_t>& code);
+};
+
+
+//Find every line the program can reach and make sure ENDLOOP never runs before a LOOP has set
+//the loop count.  Anything odd (unknown opcodes, jumps past the end) is left to the interpreter.
+bool cCompiler::compile(const vector<uint32_t>& code) {
+
+	uint32_t size = code.size();
+	vector<bool> reachable(size, false);
+	vector<bool> loopUnset(size, false);		//can run before any LOOP
+	vector<uint32_t> work;
+
+	reachable[0] = true;
+	loopUnset[0] = true;
+	work.push_back(0);
+	while (!work.empty()) {
+		uint32_t pos = work.back();
+		work.pop_back();
+
+		uint32_t op = code[pos];
+		if ((op > HASHOP_MEMGEN_PARTIAL) || (pos + jitOpWords[op] > size))
+			return false;
+		if ((op == HASHOP_ENDLOOP) && loopUnset[pos])
+			return false;
+		if ((op == HASHOP_LOOP) && (code[pos + 1] == 0))
+			return false;
+		if ((op == HASHOP_IF) && (code[pos + 1] == 0))
+			return false;
+
+		uint32_t next[2];
+		int count = 0;
+		if (op != HASHOP_END)
+			next[count++] = pos + jitOpWords[op];
+		if (op == HASHOP_IF)
+			next[count++] = pos + 3 + code[pos + 2];
+
+		for (int i = 0; i < count; i++) {
+			if (next[i] >= size)
+				return false;
+			bool unset = loopUnset[pos] && (op != HASHOP_LOOP);
+			if (!reachable[next[i]] || (unset && !loopUnset[next[i]])) {
+				reachable[next[i]] = true;
+				loopUnset[next[i]] = loopUnset[next[i]] || unset;
+				work.push_back(next[i]);
+			}
+		}
+	}
+
+	vector<int> line(size + 1);
+	for (uint32_t pos = 0; pos <= size; pos++)
+		line[pos] = e.newLabel();
+	int epilogue = e.newLabel();
+
+	//prologue - 6 pushes and the frame keep rsp 16 byte aligned for the helper calls
+	e.push(RBX);
+	e.push(RBP);
+	e.push(R12);
+	e.push(R13);
+	e.push(R14);
+	e.push(R15);
+	e.subRI8(RSP, FRAME_SIZE);
+	e.movRR(R12, RDI);
+	e.movRR(R13, RSI);
+	e.movRR(R14, RDX);
+	e.movRR(R15, RCX);
+	e.movRR(RBX, R8);
+	e.xorRR32(RBP, RBP);
+	e.movdquLoad(HASH_LO, R12, 0);
+	e.movdquLoad(HASH_HI, R12, 16);
+
+	uint32_t fallsTo = 0;		//line the previous op continues with
+	for (uint32_t pos = 0; pos < size; pos++) {
+		if (!reachable[pos])
+			continue;
+		if (fallsTo != pos)
+			e.jmp(line[fallsTo]);
+		e.bind(line[pos]);
+
+		const uint32_t* arg = &code[pos + 1];
+		uint32_t next = pos + jitOpWords[code[pos]];
+		fallsTo = next;
+
+		switch (code[pos]) {
+
+		case HASHOP_ADD:
+		case HASHOP_XOR: {
+			size_t lo = e.constant(&arg[0]);
+			size_t hi = e.constant(&arg[4]);
+			if (code[pos] == HASHOP_ADD) {
+				e.padddPool(HASH_LO, lo);
+				e.padddPool(HASH_HI, hi);
+			}
+			else {
+				e.pxorPool(HASH_LO, lo);
+				e.pxorPool(HASH_HI, hi);
+			}
+			break;
+		}
+
+		case HASHOP_SHA_SINGLE:
+			sha();
+			break;
+
+		case HASHOP_SHA_LOOP:
+			if (arg[0] <= SHA_UNROLL) {
+				for (uint32_t i = 0; i < arg[0]; i++)
+					sha();
+			}
+			else {
+				int loop = e.newLabel();
+				e.storeSlotI32(SLOT_SHA_COUNT, arg[0]);
+				e.bind(loop);
+				sha();
+				e.decSlot32(SLOT_SHA_COUNT);
+				e.jne(loop);
+			}
+			break;
+
+		case HASHOP_MEMGEN:
+		case HASHOP_MEMGEN_PARTIAL: {
+			uint32_t rows = (code[pos] == HASHOP_MEMGEN) ? arg[0] : arg[1];
+			e.movRI32(RBP, arg[0]);
+			if (rows == 0)
+				break;
+			int loop = e.newLabel();
+			e.storeSlot64(SLOT_ROW_PTR, R13);
+			e.storeSlotI32(SLOT_ROWS_LEFT, rows);
+			e.bind(loop);
+			sha();
+			e.loadSlot64(RAX, SLOT_ROW_PTR);
+			e.movdquStore(RAX, 0, HASH_LO);
+			e.movdquStore(RAX, 16, HASH_HI);
+			e.addRI8(RAX, 32);
+			e.storeSlot64(SLOT_ROW_PTR, RAX);
+			e.decSlot32(SLOT_ROWS_LEFT);
+			e.jne(loop);
+			break;
+		}
+
+		case HASHOP_MEMADD:
+		case HASHOP_MEMXOR:
+			e.movdqaPool(10, e.constant(&arg[0]));
+			e.movdqaPool(11, e.constant(&arg[4]));
+			memRows(code[pos] == HASHOP_MEMADD, false);
+			break;
+
+		case HASHOP_MEMADDXOR:
+			e.movdqaPool(10, e.constant(&arg[0]));
+			e.movdqaPool(11, e.constant(&arg[4]));
+			e.movdqaPool(14, e.constant(&arg[8]));
+			e.movdqaPool(15, e.constant(&arg[12]));
+			memRows(true, false, true);
+			break;
+
+		case HASHOP_MEMADDHASHPREV:
+			e.movdquLoad(10, R15, 0);
+			e.paddd(10, HASH_LO);
+			e.movdquLoad(11, R15, 16);
+			e.paddd(11, HASH_HI);
+			memRows(true, false);
+			break;
+
+		case HASHOP_MEMXORHASHPREV:
+			e.movdquLoad(10, R15, 0);
+			e.movdquLoad(11, R15, 16);
+			memRows(false, true);
+			break;
+
+		case HASHOP_MEM_SELECT:
+			e.movRI32(RAX, arg[0]);
+			e.xorRR32(RDX, RDX);
+			e.divR32(RBP);
+			loadRow();
+			break;
+
+		case HASHOP_END:
+			e.jmp(epilogue);
+			fallsTo = size;
+			break;
+
+		case HASHOP_READMEM2:
+			if (arg[0] <= 1) {
+				e.movdquLoad(10, R15, 0);
+				e.movdquLoad(11, R15, 16);
+				if (arg[0] == 0) {
+					e.pxor(HASH_LO, 10);
+					e.pxor(HASH_HI, 11);
+				}
+				else {
+					e.paddd(HASH_LO, 10);
+					e.paddd(HASH_HI, 11);
+				}
+			}
+			sum8();
+			e.xorRR32(RDX, RDX);
+			e.divR32(RBP);
+			loadRow();
+			break;
+
+		case HASHOP_LOOP:
+			sum8();
+			e.xorRR32(RDX, RDX);
+			e.movRI32(RCX, arg[0]);
+			e.divR32(RCX);
+			e.incR32(RDX);
+			e.storeSlot32(SLOT_LOOP_COUNT, RDX);
+			e.leaLabel(RAX, line[next]);
+			e.storeSlot64(SLOT_LOOP_START, RAX);
+			break;
+
+		case HASHOP_ENDLOOP: {
+			int exit = e.newLabel();
+			e.decSlot32(SLOT_LOOP_COUNT);
+			e.je(exit);
+			e.jmpSlot(SLOT_LOOP_START);
+			e.bind(exit);
+			break;
+		}
+
+		case HASHOP_IF:
+			sum8();
+			e.xorRR32(RDX, RDX);
+			e.movRI32(RCX, arg[0]);
+			e.divR32(RCX);
+			e.testRR32(RDX, RDX);
+			e.je(line[next + arg[1]]);
+			break;
+
+		case HASHOP_STORETEMP:
+			e.movdquStore(R14, 0, HASH_LO);
+			e.movdquStore(R14, 16, HASH_HI);
+			break;
+
+		case HASHOP_EXECOP: {
+			int doXor = e.newLabel();
+			int doSha = e.newLabel();
+			int done = e.newLabel();
+			sum8();
+			e.xorRR32(RDX, RDX);
+			e.movRI32(RCX, 3);
+			e.divR32(RCX);
+			e.cmpRI8_32(RDX, 1);
+			e.je(doXor);
+			e.ja(doSha);
+			e.movdquLoad(10, R14, 0);
+			e.movdquLoad(11, R14, 16);
+			e.paddd(HASH_LO, 10);
+			e.paddd(HASH_HI, 11);
+			e.jmp(done);
+			e.bind(doXor);
+			e.movdquLoad(10, R14, 0);
+			e.movdquLoad(11, R14, 16);
+			e.pxor(HASH_LO, 10);
+			e.pxor(HASH_HI, 11);
+			e.jmp(done);
+			e.bind(doSha);
+			sha();
+			e.bind(done);
+			break;
+		}
+
+		case HASHOP_SUMBLOCK:
+			sumBlock();
+			break;
+		}
+	}
+	if (fallsTo != size)
+		e.jmp(line[fallsTo]);
+
+	e.bind(epilogue);
+	e.movdquStore(R12, 0, HASH_LO);
+	e.movdquStore(R12, 16, HASH_HI);
+	e.addRI8(RSP, FRAME_SIZE);
+	e.pop(R15);
+	e.pop(R14);
+	e.pop(R13);
+	e.pop(R12);
+	e.pop(RBP);
+	e.pop(RBX);
+	e.ret();
+
+	return true;
+}
+
+}
+
+#endif
+
+
+shared_ptr<cProgramJIT> cProgramJIT::compile(const vector<uint32_t>& byteCode) {
+
+#ifdef PROGRAM_JIT
+	if (byteCode.empty())
+		return NULL;
+
+	//FNV-1a over the program words
+	uint64_t key = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < byteCode.size(); i++) {
+		key ^= byteCode[i];
+		key *= 0x100000001b3ULL;
+	}
+
+	map<uint64_t, shared_ptr<cProgramJIT>>::iterator it = cache.find(key);
+	if ((it != cache.end()) && (it->second->byteCode == byteCode))
+		return it->second;
+
+	cCompiler compiler;
+	if (!compiler.compile(byteCode))
+		return NULL;
+	size_t imageSize = compiler.e.finish();
+
+	size_t pageSize = 4096;
+	size_t mapSize = (imageSize + pageSize - 1) & ~(pageSize - 1);
+	void* memory = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return NULL;
+	memcpy(memory, compiler.e.code.data(), imageSize);
+	if (mprotect(memory, mapSize, PROT_READ | PROT_EXEC) != 0) {
+		munmap(memory, mapSize);
+		return NULL;
+	}
+
+	shared_ptr<cProgramJIT> program(new cProgramJIT());
+	program->function = (tJitFunction)memory;
+	program->memory = memory;
+	program->memorySize = mapSize;
+	program->codeSize = imageSize;
+	program->byteCode = byteCode;
+
+	//drop programs no job holds any more once the cache is full
+	if (cache.size() >= JIT_CACHE_SIZE) {
+		for (it = cache.begin(); it != cache.end();) {
+			if (it->second.use_count() == 1)
+				cache.erase(it++);
+			else
+				++it;
+		}
+	}
+	cache[key] = program;
+
+	return program;
+#else
+	return NULL;
+#endif
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <memory>
+#include <stdint.h>
+
+#include "sha256.h"
+
+class cPreparedJob;
+class cMinerScratch;
+
+using namespace std;
+
+//The JIT emits SysV x86-64 code, so it is only built for 64 bit x86 outside Windows.  Everywhere
+//else compile() returns NULL and the miners stay on the interpreter.
+#if (defined(__x86_64__) || defined(__amd64__)) && !defined(_WIN32)
+#define PROGRAM_JIT
+#endif
+
+//hash, memGen, tempStore, prevHashSHA, hashBlock
+typedef void (*tJitFunction)(uint32_t*, uint32_t*, uint32_t*, const uint32_t*, const unsigned char*);
+
+//A hash program compiled to native code.  ADD/XOR/MEMADD/MEMXOR operands are immediates in the
+//code's constant pool, fixed count SHA loops are unrolled and, on CPUs with the SHA extensions,
+//the SHA-256 rounds are emitted inline.  The hash lives in two XMM registers for the whole run.
+class cProgramJIT
+{
+public:
+	~cProgramJIT();
+
+	//Compile byteCode, or return the cached copy of an identical program.  Returns NULL when the
+	//program cannot be compiled, the caller then falls back to the interpreter.
+	//Only called from the network thread.
+	static shared_ptr<cProgramJIT> compile(const vector<uint32_t>& byteCode);
+
+	void runProgram(const cPreparedJob* job, uint32_t nonce, uint32_t* hash, cMinerScratch* scratch, const unsigned char* hashBlock) const;
+
+	static bool enabled;			//compile jobs at all - set when a CPU miner uses the jit engine
+	static bool inlineShani;		//emit SHA-NI rounds instead of calling SHA256_32
+
+	vector<uint32_t> byteCode;		//program this was compiled from, to rule out hash collisions
+	size_t codeSize;
+
+private:
+	cProgramJIT();
+
+	tJitFunction function;
+	void* memory;
+	size_t memorySize;
+
+	static map<uint64_t, shared_ptr<cProgramJIT>> cache;
+};
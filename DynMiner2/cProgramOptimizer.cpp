@@ -0,0 +1,347 @@
+#include "cProgramOptimizer.h"
+#include "cMiner.h"
+#include "cGetWork.h"
+#include "cThreadedVM.h"
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <chrono>
+
+//words taken by each opcode, including the opcode itself
+static const uint32_t optWords[HASHOP_MEMGEN_PARTIAL + 1] = { 9, 9, 1, 2, 2, 9, 9, 2, 1, 3, 2, 1, 3, 1, 2, 1, 1, 1, 17, 3 };
+
+//One instruction of the program being rewritten.  SHA2 is held as SHA2 1 until it is written out.
+struct sOptLine
+{
+	uint32_t op;
+	uint32_t arg[16];
+	uint32_t argCount;
+	int target;				//IF - line the skip lands on
+};
+
+
+static bool isZero(const uint32_t* v, int count) {
+	for (int i = 0; i < count; i++)
+		if (v[i] != 0)
+			return false;
+	return true;
+}
+
+//true when the line does nothing and can be left out
+static bool isIdentity(const sOptLine& line) {
+	switch (line.op) {
+	case HASHOP_ADD:
+	case HASHOP_XOR:
+	case HASHOP_MEMADD:
+	case HASHOP_MEMXOR:
+		return isZero(line.arg, 8);
+	case HASHOP_MEMADDXOR:
+		return isZero(line.arg, 16);
+	case HASHOP_SHA_LOOP:
+		return line.arg[0] == 0;
+	}
+	return false;
+}
+
+//fold line b into line a, which runs right before it
+static bool merge(sOptLine& a, const sOptLine& b) {
+
+	if ((a.op == HASHOP_ADD || a.op == HASHOP_MEMADD) && (b.op == a.op)) {
+		for (int j = 0; j < 8; j++)
+			a.arg[j] += b.arg[j];
+		return true;
+	}
+
+	if ((a.op == HASHOP_XOR || a.op == HASHOP_MEMXOR) && (b.op == a.op)) {
+		for (int j = 0; j < 8; j++)
+			a.arg[j] ^= b.arg[j];
+		return true;
+	}
+
+	if ((a.op == HASHOP_SHA_LOOP) && (b.op == HASHOP_SHA_LOOP) && ((uint64_t)a.arg[0] + b.arg[0] <= 0xFFFFFFFF)) {
+		a.arg[0] += b.arg[0];
+		return true;
+	}
+
+	//(row + a) ^ b
+	if ((a.op == HASHOP_MEMADD) && (b.op == HASHOP_MEMXOR)) {
+		a.op = HASHOP_MEMADDXOR;
+		memcpy(&a.arg[8], b.arg, 32);
+		a.argCount = 16;
+		return true;
+	}
+
+	if ((a.op == HASHOP_MEMADDXOR) && (b.op == HASHOP_MEMXOR)) {
+		for (int j = 0; j < 8; j++)
+			a.arg[8 + j] ^= b.arg[j];
+		return true;
+	}
+
+	if ((a.op == HASHOP_MEMADD) && (b.op == HASHOP_MEMADDXOR)) {
+		for (int j = 0; j < 8; j++)
+			a.arg[j] += b.arg[j];
+		a.op = HASHOP_MEMADDXOR;
+		memcpy(&a.arg[8], &b.arg[8], 32);
+		a.argCount = 16;
+		return true;
+	}
+
+	return false;
+}
+
+//a MEMADDXOR left with a zero half is a plain MEMADD or MEMXOR
+static void simplify(sOptLine& line) {
+	if (line.op != HASHOP_MEMADDXOR)
+		return;
+	if (isZero(&line.arg[8], 8)) {
+		line.op = HASHOP_MEMADD;
+		line.argCount = 8;
+	}
+	else if (isZero(line.arg, 8)) {
+		line.op = HASHOP_MEMXOR;
+		memmove(line.arg, &line.arg[8], 32);
+		line.argCount = 8;
+	}
+}
+
+
+//Rows of the memgen buffer that the lines reachable from line start can read before the next
+//MEMGEN.  Returns the highest MEM_SELECT row (or -1 when nothing is read), or -2 when a READMEM2
+//reads a row that depends on the hash.  ENDLOOP is taken to go back to any loop.
+static int64_t memgenReads(const vector<sOptLine>& lines, uint32_t start, uint32_t memSize) {
+
+	vector<uint32_t> loopStarts;
+	for (uint32_t i = 0; i + 1 < lines.size(); i++)
+		if (lines[i].op == HASHOP_LOOP)
+			loopStarts.push_back(i + 1);
+
+	int64_t highest = -1;
+	vector<bool> seen(lines.size(), false);
+	vector<uint32_t> work;
+	if (start < lines.size()) {
+		seen[start] = true;
+		work.push_back(start);
+	}
+	while (!work.empty()) {
+		uint32_t i = work.back();
+		work.pop_back();
+
+		const sOptLine& line = lines[i];
+		if ((line.op == HASHOP_MEMGEN) || (line.op == HASHOP_MEMGEN_PARTIAL) || (line.op == HASHOP_END))
+			continue;
+		if (line.op == HASHOP_READMEM2)
+			return -2;
+		if ((line.op == HASHOP_MEM_SELECT) && ((int64_t)(line.arg[0] % memSize) > highest))
+			highest = line.arg[0] % memSize;
+
+		vector<uint32_t> next;
+		next.push_back(i + 1);
+		if (line.op == HASHOP_IF)
+			next.push_back(line.target);
+		if (line.op == HASHOP_ENDLOOP)
+			next.insert(next.end(), loopStarts.begin(), loopStarts.end());
+		for (size_t k = 0; k < next.size(); k++)
+			if ((next[k] < lines.size()) && !seen[next[k]]) {
+				seen[next[k]] = true;
+				work.push_back(next[k]);
+			}
+	}
+	return highest;
+}
+
+
+//MEM_SELECT's operand comes from the merkle root or prevHash, so for
+//  MEMGEN n, [MEMADD/MEMXOR ...], MEM_SELECT c
+//the row that is read is known for the whole job.  The hash MEMGEN leaves behind is overwritten
+//by the MEM_SELECT, so rows past the highest one read are never needed:
+//  - nothing else reads this memgen - the row is hashed in place and the MEMADD/MEMXOR become
+//    ADD/XOR: SHA2 c % n + 1, [ADD/XOR ...]
+//  - only other MEM_SELECTs read it - MEMGEN_PARTIAL n, rows, with rows the highest one read + 1
+static void staticMemSelect(vector<sOptLine>& lines, const vector<bool>& isTarget) {
+
+	for (uint32_t g = 0; g < lines.size(); g++) {
+		if ((lines[g].op != HASHOP_MEMGEN) || (lines[g].arg[0] == 0))
+			continue;
+		uint32_t memSize = lines[g].arg[0];
+
+		//straight run of constant memgen updates up to the MEM_SELECT
+		uint32_t sel = g + 1;
+		bool entered = false;
+		while ((sel < lines.size()) && ((lines[sel].op == HASHOP_MEMADD) || (lines[sel].op == HASHOP_MEMXOR))) {
+			entered |= isTarget[sel];
+			sel++;
+		}
+		if ((sel == lines.size()) || (lines[sel].op != HASHOP_MEM_SELECT))
+			continue;
+		entered |= isTarget[sel];
+
+		int64_t row = lines[sel].arg[0] % memSize;
+		int64_t later = memgenReads(lines, sel + 1, memSize);
+		if (later == -2)
+			continue;
+
+		if ((later == -1) && !entered) {
+			lines[g].op = HASHOP_SHA_LOOP;
+			lines[g].arg[0] = row + 1;
+			lines[g].argCount = 1;
+			for (uint32_t i = g + 1; i < sel; i++)
+				lines[i].op = (lines[i].op == HASHOP_MEMADD) ? HASHOP_ADD : HASHOP_XOR;
+			lines[sel].op = HASHOP_SHA_LOOP;		//SHA2 0, dropped
+			lines[sel].arg[0] = 0;
+			lines[sel].argCount = 1;
+			continue;
+		}
+
+		if (later > row)
+			row = later;
+		if (row + 1 < memSize) {
+			lines[g].op = HASHOP_MEMGEN_PARTIAL;
+			lines[g].arg[1] = row + 1;
+			lines[g].argCount = 2;
+		}
+	}
+}
+
+
+vector<uint32_t> cProgramOptimizer::optimize(const vector<uint32_t>& byteCode) {
+
+	uint32_t size = byteCode.size();
+
+	//split into lines, anything that is not a clean run of known instructions is left alone
+	vector<sOptLine> lines;
+	vector<int> lineAt(size + 1, -1);
+	uint32_t pos = 0;
+	while (pos < size) {
+		uint32_t op = byteCode[pos];
+		if ((op > HASHOP_SUMBLOCK) || (pos + optWords[op] > size))
+			return byteCode;
+
+		sOptLine line;
+		line.op = op;
+		line.argCount = optWords[op] - 1;
+		line.target = -1;
+		memcpy(line.arg, &byteCode[pos + 1], line.argCount * 4);
+		if (op == HASHOP_SHA_SINGLE) {
+			line.op = HASHOP_SHA_LOOP;
+			line.arg[0] = 1;
+			line.argCount = 1;
+		}
+
+		lineAt[pos] = lines.size();
+		lines.push_back(line);
+		pos += optWords[op];
+	}
+
+	//lines something can jump to: IF skips and the first line of a LOOP body
+	vector<bool> isTarget(lines.size() + 1, false);
+	pos = 0;
+	for (uint32_t i = 0; i < lines.size(); i++) {
+		uint32_t words = optWords[byteCode[pos]];
+		if (lines[i].op == HASHOP_IF) {
+			uint64_t target = (uint64_t)pos + 3 + lines[i].arg[1];
+			if ((target >= size) || (lineAt[target] < 0))
+				return byteCode;
+			lines[i].target = lineAt[target];
+			isTarget[lines[i].target] = true;
+		}
+		if (lines[i].op == HASHOP_LOOP) {
+			if (pos + 2 >= size)
+				return byteCode;
+			isTarget[i + 1] = true;
+		}
+		pos += words;
+	}
+
+	staticMemSelect(lines, isTarget);
+
+	//fold each line into the one before it unless a jump lands between them
+	vector<sOptLine> out;
+	vector<int> outAt(lines.size(), -1);		//first output line a jump to line i runs
+	size_t mergeFloor = 0;
+	for (uint32_t i = 0; i < lines.size(); i++) {
+		if (isTarget[i])
+			mergeFloor = out.size();
+		outAt[i] = out.size();
+
+		if (isIdentity(lines[i]))
+			continue;
+
+		if ((out.size() > mergeFloor) && merge(out.back(), lines[i])) {
+			if (isIdentity(out.back()))
+				out.pop_back();
+			continue;
+		}
+
+		out.push_back(lines[i]);
+	}
+
+	//lay the lines out and point the IF skips at their new targets
+	vector<uint32_t> outPos(out.size() + 1);
+	uint32_t outSize = 0;
+	for (uint32_t k = 0; k < out.size(); k++) {
+		simplify(out[k]);
+		if ((out[k].op == HASHOP_SHA_LOOP) && (out[k].arg[0] == 1))
+			out[k].argCount = 0;
+		outPos[k] = outSize;
+		outSize += 1 + out[k].argCount;
+	}
+	outPos[out.size()] = outSize;
+
+	vector<uint32_t> optimized;
+	optimized.reserve(outSize);
+	for (uint32_t k = 0; k < out.size(); k++) {
+		sOptLine& line = out[k];
+		if (line.op == HASHOP_IF)
+			line.arg[1] = outPos[outAt[line.target]] - (outPos[k] + 3);
+		optimized.push_back(((line.op == HASHOP_SHA_LOOP) && (line.argCount == 0)) ? HASHOP_SHA_SINGLE : line.op);
+		optimized.insert(optimized.end(), line.arg, line.arg + line.argCount);
+	}
+
+	return optimized;
+}
+
+
+bool cProgramOptimizer::verify(const vector<uint32_t>& original, const vector<uint32_t>& optimized, const unsigned char* hashBlock, int headers) {
+
+	mt19937 rng((uint32_t)chrono::steady_clock::now().time_since_epoch().count());
+
+	cPreparedJob jobA;
+	cPreparedJob jobB;
+	jobA.byteCode = original;
+	jobB.byteCode = optimized;
+	cThreadedVM::decode(jobA.byteCode, jobA.threadedCode);
+	cThreadedVM::decode(jobB.byteCode, jobB.threadedCode);
+
+	cMinerScratch* scratch = new cMinerScratch();
+	bool same = true;
+
+	for (int h = 0; (h < headers) && same; h++) {
+		unsigned char header[80];
+		for (int i = 0; i < 80; i++)
+			header[i] = rng();
+
+		memcpy(jobA.header, header, 80);
+		SHA256_80_Midstate(jobA.midstate, header);
+		CSHA256 sha256;
+		sha256.Write(&header[4], 32);
+		sha256.Finalize((unsigned char*)jobA.prevHashSHA);
+
+		memcpy(jobB.header, jobA.header, 80);
+		memcpy(jobB.midstate, jobA.midstate, 32);
+		memcpy(jobB.prevHashSHA, jobA.prevHashSHA, 32);
+
+		uint32_t nonce = rng();
+		uint32_t hashA[8];
+		uint32_t hashB[8];
+		cThreadedVM::runProgram(&jobA, nonce, hashA, scratch, hashBlock);
+		cThreadedVM::runProgram(&jobB, nonce, hashB, scratch, hashBlock);
+
+		if (memcmp(hashA, hashB, 32) != 0) {
+			printf("Optimized hash program differs on nonce %08X: %08X%08X... vs %08X%08X...\n", nonce, hashA[0], hashA[1], hashB[0], hashB[1]);
+			same = false;
+		}
+	}
+
+	delete scratch;
+	return same;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+//Rewrites a finalized hash program into a shorter one with the same result for every header:
+//  - consecutive ADDs and consecutive XORs fold into one line, ADD 0 / XOR 0 are dropped
+//  - SHA2 and SHA2 n lines that follow each other become one SHA_LOOP
+//  - MEMADD/MEMXOR runs fold, MEMADD followed by MEMXOR becomes one MEMADDXOR pass over memgen
+//  - a MEMGEN whose rows are only read by MEM_SELECT stops at the last row read, see staticMemSelect
+//Lines an IF or ENDLOOP can jump to are never folded into the line before them, and IF skips
+//are recomputed for the new layout.  A program whose jumps do not land on whole instructions is
+//returned as is.
+class cProgramOptimizer
+{
+public:
+	static vector<uint32_t> optimize(const vector<uint32_t>& byteCode);
+
+	//Run both programs on random headers and nonces and compare the hashes.  Returns false and
+	//prints the first difference when they disagree.
+	static bool verify(const vector<uint32_t>& original, const vector<uint32_t>& optimized, const unsigned char* hashBlock, int headers);
+};
@@ -27,7 +27,9 @@ enum eOpcode {
     EXECOP = 14,
     MEMADDHASHPREV = 15,
     MEMXORHASHPREV = 16,
-    SUMBLOCK = 17
+    SUMBLOCK = 17,
+    MEMADDXOR = 18,     //MEMADD + MEMXOR in one pass, only emitted by cProgramOptimizer
+    MEMGEN_PARTIAL = 19 //MEMGEN that stops after the rows MEM_SELECT reads, only emitted by cProgramOptimizer
 
 };
 
@@ -53,7 +53,7 @@ void cStatDisplay::displayStats(cSubmitter *submitter, string mode, int hiveos,
         {
             std::this_thread::sleep_for(std::chrono::seconds(5));
 
-            uint64_t nonce = totalStats->nonce_count;
+            uint64_t nonce = collectHashes();
 
             struct tm* timeinfo;
             char timestamp[80];
@@ -149,7 +149,32 @@ void cStatDisplay::displayStats(cSubmitter *submitter, string mode, int hiveos,
             SET_COLOR(LIGHTGRAY);
             printf(" | ");
             SET_COLOR(LIGHTGREEN);
-            printf(" HQ:%-4d", submitter->hashList.size());
+            //submit queue depth and the average time from found to sent
+            uint64_t sent = submitter->sentCount;
+            printf(" Q:%-3u %.1fms", submitter->results.size(), (sent == 0) ? 0.0 : submitter->latencyMicros / 1000.0 / sent);
+            if (submitter->staleCount + submitter->droppedCount > 0)
+                printf(" stale:%u dropped:%u", submitter->staleCount.load(), submitter->droppedCount.load());
+            //average time each GPU kept hashing the old job after a job switch
+            {
+                lock_guard<mutex> lock(cardLock);
+                std::map<string, cStats*>::iterator it;
+                for (it = perCardStats.begin(); it != perCardStats.end(); it++) {
+                    uint32_t switches = it->second->jobSwitches;
+                    if (switches > 0)
+                        printf(" %s stale:%.1fms", it->first.c_str(), it->second->staleMicros / 1000.0 / switches);
+                }
+            }
+            SET_COLOR(LIGHTGRAY);
+            printf(" | ");
+            SET_COLOR(CYAN);
+            printf("SHA:%s ", sha256Impl.c_str());
+
+            for (size_t n = 0; n < nodeStats.size(); n++) {
+                SET_COLOR(LIGHTGRAY);
+                printf(" | ");
+                SET_COLOR(GREEN);
+                printf("node%d:%.2f KH/s", (int)n, (double)nodeStats[n]->nonce_count / (double)(now - start) / kb);
+            }
 
             if (mode == "solo") {
                 SET_COLOR(LIGHTGRAY);
@@ -169,6 +194,8 @@ void cStatDisplay::displayStats(cSubmitter *submitter, string mode, int hiveos,
         {
             std::this_thread::sleep_for(std::chrono::seconds(5));
 
+            collectHashes();
+            lock_guard<mutex> lock(cardLock);
             std::map<string, cStats*>::iterator it;
 
             for (it = perCardStats.begin(); it != perCardStats.end(); it++) {
@@ -210,6 +237,9 @@ void cStatDisplay::displayStats(cSubmitter *submitter, string mode, int hiveos,
                 printf(" | ");
 
                 printf("%8lu", it->second->share_count.load(std::memory_order_relaxed));
+                uint32_t switches = it->second->jobSwitches;
+                if (switches > 0)
+                    printf(" | stale %.1f ms", it->second->staleMicros / 1000.0 / switches);
                 printf("\n");
 
             }
@@ -218,7 +248,49 @@ void cStatDisplay::displayStats(cSubmitter *submitter, string mode, int hiveos,
 
 }
 
-void cStatDisplay::addCard(string key) {
-    cStats* newStats = new cStats();
-    perCardStats.emplace(key, newStats);
+//Each worker gets its own counter.  Workers with the same key (CPU threads of two CPU miners)
+//share the card.
+cHashCounter* cStatDisplay::addCard(string key, int node) {
+    cHashCounter* counter = new cHashCounter();
+    counter->node = node;
+
+    lock_guard<mutex> lock(cardLock);
+    if (perCardStats.find(key) == perCardStats.end())
+        perCardStats.emplace(key, new cStats());
+    perCardStats[key]->counters.push_back(counter);
+    return counter;
+}
+
+//The stats of a card added with addCard
+cStats* cStatDisplay::cardStats(string key) {
+    lock_guard<mutex> lock(cardLock);
+    return perCardStats[key];
+}
+
+//Sum the worker counters into the card, node and total stats.  Returns the total.
+uint64_t cStatDisplay::collectHashes() {
+    lock_guard<mutex> lock(cardLock);
+
+    vector<uint64_t> perNode(nodeStats.size(), 0);
+    uint64_t total = 0;
+
+    std::map<string, cStats*>::iterator it;
+    for (it = perCardStats.begin(); it != perCardStats.end(); it++) {
+        uint64_t card = 0;
+        for (size_t i = 0; i < it->second->counters.size(); i++) {
+            cHashCounter* counter = it->second->counters[i];
+            uint64_t count = counter->count.load(memory_order_relaxed);
+            card += count;
+            if ((counter->node >= 0) && (counter->node < (int)perNode.size()))
+                perNode[counter->node] += count;
+        }
+        it->second->nonce_count = card;
+        total += card;
+    }
+
+    for (size_t n = 0; n < nodeStats.size(); n++)
+        nodeStats[n]->nonce_count = perNode[n];
+    totalStats->nonce_count = total;
+
+    return total;
 }
@@ -6,8 +6,11 @@
 #include <string>
 #include <thread>
 #include <map>
+#include <vector>
+#include <mutex>
 
 #include "version.h"
+#include "memgen_rows.h"
 
 class cSubmitter;
 
@@ -27,15 +30,35 @@ using namespace std;
 #endif
 
 
+//Hashes done by one CPU thread or GPU.  Only that worker writes it, with a plain load and store
+//instead of a locked add, and each counter is aligned to its own cache line so workers never
+//share one.  The display thread sums them.
+class alignas(64) cHashCounter {
+public:
+    cHashCounter() : count(0), node(-1) {}
+
+    //the C++11 operator new does not honour alignas
+    static void* operator new(size_t size) { return MemRowsAlloc(size); }
+    static void operator delete(void* ptr) { MemRowsFree(ptr); }
+
+    inline void add(uint64_t n) { count.store(count.load(memory_order_relaxed) + n, memory_order_relaxed); }
+
+    atomic<uint64_t> count;
+    int node;           //NUMA node the worker runs on, -1 when nodes are not tracked
+};
+
 class cStats  {
 public:
-    atomic<uint64_t> nonce_count{};
+    atomic<uint64_t> nonce_count{};     //totals and cards - the sum of the worker counters, see collectHashes
     atomic<uint64_t> share_count{};
     atomic<uint32_t> accepted_share_count{};
     atomic<uint32_t> rejected_share_count{};
     atomic<uint32_t> latest_diff{};
     atomic<uint32_t> network_diff{};
     uint32_t blockHeight;
+    vector<cHashCounter*> counters;     //workers reporting under this card
+    atomic<uint32_t> jobSwitches{};     //GPU - every switch to a new job
+    atomic<uint64_t> staleMicros{};     //GPU - time from each new job's publish until the old job's batches were drained
 };
 
 class cStatDisplay
@@ -43,12 +66,17 @@ class cStatDisplay
 
 public:
 	void displayStats(cSubmitter* submitter, string mode, int hiveos, string statURL, string minerName);
-    void addCard(string key);
+    cHashCounter* addCard(string key, int node = -1);
+    cStats* cardStats(string key);
+    uint64_t collectHashes();
 
     string seconds_to_uptime(int n);
 
     cStats* totalStats;
     std::map<string, cStats*> perCardStats;
+    mutex cardLock;             //miner threads add cards while the display reads them
+    vector<cStats*> nodeStats;  //CPU miner hashes per NUMA node, empty on single node machines
+    string sha256Impl;          //SHA-256 implementation picked at startup
     
     const double tb = 1099511627776;
     const double gb = 1073741824;
@@ -3,184 +3,129 @@
 #include "cStatDisplay.h"
 
 
-void cSubmitter::submitEvalThread(cGetWork *getWork, cStatDisplay *iStatDisplay, string mode) {
-
-    statDisplay = iStatDisplay;
-    minerMode = mode;
-
-    return;
-
-    while (getWork->workID == 0)
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-    thread submitThread(&cSubmitter::submitNonceThread, this, getWork);
-    submitThread.detach();
-
-    rpcSequence = 0;
-
-    curl = curl_easy_init();
-
-	while (true) {
-
-		hashListLock.lock();
-		if (!hashList.empty()) {
-        	cHashResult *hashResult = hashList[0];
-			hashList.erase(hashList.begin());
-			hashListLock.unlock();
-
-            if (mode == "stratum") {
-                uint64_t target = share_to_target(getWork->difficultyTarget) * 65536;
-
-                // find a hash with difficulty higher than share diff
-                for (uint32_t k = 0; k < hashResult->hashCount; k++) {
-                    uint64_t hash_int{};
-                    memcpy(&hash_int, &hashResult->buffer[k*32], 8);
-                    hash_int = htobe64(hash_int);
-                    if (hash_int < target) {
-                        nonceListLock.lock();
-                        uint32_t nonce = hashResult->nonceIndex[k];
-                        cNonceEntry* entry = new cNonceEntry();
-                        entry->nonce = nonce;
-                        entry->jobID = hashResult->jobID;
-                        nonceList.push_back(entry);
-                        nonceListLock.unlock();
-                    }
-                }
-            }
-            else if (mode == "solo") {
-                unsigned int target = countLeadingZeros((unsigned char*)(getWork->iNativeTarget));
-                unsigned char* ptr = hashResult->buffer;
-                for (uint32_t k = 0; k < hashResult->hashCount; k++) {
-                    unsigned int numZeros = countLeadingZeros(ptr);
-                    if (numZeros > target) {
-                        nonceListLock.lock();
-                        uint32_t nonce = hashResult->nonceIndex[k];
-                        cNonceEntry* entry = new cNonceEntry();
-                        entry->nonce = nonce;
-                        entry->jobID = hashResult->jobID;
-                        nonceList.push_back(entry);
-                        nonceListLock.unlock();
-                    }
-                    ptr += 32;
-                }
-
-            }
+cResultQueue::cResultQueue() {
+    for (uint32_t i = 0; i < RESULT_QUEUE_SIZE; i++)
+        cells[i].sequence = i;
+    enqueuePos = 0;
+    dequeuePos = 0;
+}
 
-            free(hashResult->nonceIndex);
-            free(hashResult->buffer);
-            delete hashResult;
-
-		}
-        else {
-            hashListLock.unlock();
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+//A cell is free for the producer whose position matches its sequence, and full for the
+//consumer when the sequence is one past it.
+bool cResultQueue::push(const sFoundNonce& entry) {
 
+    uint32_t pos = enqueuePos.load(memory_order_relaxed);
+    sCell* cell;
+    while (true) {
+        cell = &cells[pos & (RESULT_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t)(cell->sequence.load(memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
         }
-		
-	}
+        else if (diff < 0)
+            return false;
+        else
+            pos = enqueuePos.load(memory_order_relaxed);
+    }
 
-    //we will never get here, but anyway...
-    curl_easy_cleanup(curl);
+    cell->entry = entry;
+    cell->sequence.store(pos + 1, memory_order_release);
+    return true;
+}
+
+bool cResultQueue::ready() const {
 
+    uint32_t pos = dequeuePos.load(memory_order_relaxed);
+    return (int32_t)(cells[pos & (RESULT_QUEUE_SIZE - 1)].sequence.load(memory_order_acquire) - (pos + 1)) >= 0;
 }
 
+bool cResultQueue::pop(sFoundNonce& entry) {
 
+    uint32_t pos = dequeuePos.load(memory_order_relaxed);
+    sCell* cell = &cells[pos & (RESULT_QUEUE_SIZE - 1)];
+    if ((int32_t)(cell->sequence.load(memory_order_acquire) - (pos + 1)) < 0)
+        return false;
 
+    entry = cell->entry;
+    cell->sequence.store(pos + RESULT_QUEUE_SIZE, memory_order_release);
+    dequeuePos.store(pos + 1, memory_order_relaxed);
+    return true;
+}
 
-void cSubmitter::addHashResults(unsigned char* hashBuffer, int hashCount, string jobID, int deviceID, uint32_t* nonceIndex) {
-	hashListLock.lock();
-    cHashResult* hashResult = new cHashResult();
 
-    hashResult->buffer = (unsigned char*)malloc(hashCount * 32);
-    memcpy(hashResult->buffer, hashBuffer, hashCount * 32);
+//Sends what the miners found, so a solo submitblock or a blocking send() never holds up hashing.
+//A nonce whose job is on an older prevHash than the current job is stale and dropped.  Rolled
+//jobs and new stratum jobs on the same block still go out.
+void cSubmitter::submitThread(cGetWork* getWork, cStatDisplay* iStatDisplay, string mode) {
 
-    hashResult->nonceIndex = (uint32_t*)malloc(hashCount * 4);
-    memcpy(hashResult->nonceIndex, nonceIndex, hashCount * 4);
+    statDisplay = iStatDisplay;
+    minerMode = mode;
+    rpcSequence = 0;
 
-    hashResult->hashCount = hashCount;
-    //hashResult->startNonce = startNonce;
-    hashResult->jobID = jobID;
-    hashResult->deviceID = deviceID;
-	hashList.push_back(hashResult);
-	hashListLock.unlock();
-}
+    while (getWork->workID == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
+    int jobReader = getWork->registerJobReader();
 
-static inline uint32_t CLZz(register uint32_t x)
-{
-    x |= x >> 1;
-    x |= x >> 2;
-    x |= x >> 4;
-    x |= x >> 8;
-    x |= x >> 16;
-    x -= ((x >> 1) & 0x55555555U);
-    x = (x & 0x33333333U) + ((x >> 2) & 0x33333333U);
-    return 32U - ((((x + (x >> 4)) & 0x0F0F0F0FU) * 0x01010101U) >> 24);
-}
+    while (true) {
+        sFoundNonce found;
+        if (!results.pop(found)) {
+            unique_lock<mutex> lock(wakeLock);
+            wake.wait(lock, [this] { return results.ready(); });
+            continue;
+        }
 
+        const cPreparedJob* current = getWork->acquireJob(jobReader);
+        bool stale = (memcmp(found.job->header + 4, current->header + 4, 32) != 0);
+        getWork->releaseJob(jobReader);
 
-//todo - maybe a better way to do this, but might have only marginal CPU enhancement
-unsigned int cSubmitter::countLeadingZeros(unsigned char* hash) {
-    int c = CLZz((hash[0] << 24) + (hash[1] << 16) + (hash[2] << 8) + hash[3]);
-    if (c == 32) {
-        c += CLZz((hash[4] << 24) + (hash[5] << 16) + (hash[6] << 8) + hash[7]);
-        if (c == 64) {
-            c += CLZz((hash[8] << 24) + (hash[9] << 16) + (hash[10] << 8) + hash[11]);
-            if (c == 96) {
-                c += CLZz((hash[12] << 24) + (hash[13] << 16) + (hash[14] << 8) + hash[15]);
-                if (c == 128) {
-                    c += CLZz((hash[16] << 24) + (hash[17] << 16) + (hash[18] << 8) + hash[19]);
-                    if (c == 160) {
-                        c += CLZz((hash[20] << 24) + (hash[21] << 16) + (hash[22] << 8) + hash[23]);
-                        if (c == 192) {
-                            c += CLZz((hash[24] << 24) + (hash[25] << 16) + (hash[26] << 8) + hash[27]);
-                            if (c == 224)
-                                c += CLZz((hash[28] << 24) + (hash[29] << 16) + (hash[30] << 8) + hash[31]);
-                        }
-                    }
-                }
-            }
+        //counted for the status line, a new block can make many at once
+        if (stale)
+            staleCount++;
+        else {
+            sendNonce(found.nonce, getWork, found.job);
+            latencyMicros += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - found.found).count();
+            sentCount++;
         }
+
+        found.job->pendingSubmits--;
     }
-    return c;
 }
 
 
-void cSubmitter::submitNonceThread(cGetWork* getWork) {
-    
-    /*
-    while (true) {
-        nonceListLock.lock();
-        if (!nonceList.empty()) {
-            cNonceEntry* entry = nonceList[0];
-            nonceList.erase(nonceList.begin());
-            nonceListLock.unlock();
-
-            if (getWork->jobID == entry->jobID)
-                submitNonce(entry->nonce, getWork);
+//Miner threads - queue the nonce for the submit thread.  job must be pinned by the caller, the
+//pending count keeps it alive after that.
+void cSubmitter::submitNonce(unsigned int nonce, cGetWork* getWork, const cPreparedJob* job) {
 
-            delete entry;
-        }
-        else {
-            nonceListLock.unlock();
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    sFoundNonce found;
+    found.nonce = nonce;
+    found.job = job;
+    found.found = chrono::steady_clock::now();
 
-        }
+    job->pendingSubmits++;
+    if (!results.push(found)) {
+        job->pendingSubmits--;
+        droppedCount++;
+        return;
     }
-    */
 
+    //taking the lock orders the push before the submit thread's check, so the wakeup is not lost
+    {
+        lock_guard<mutex> lock(wakeLock);
+    }
+    wake.notify_one();
 }
 
 
-void cSubmitter::submitNonce(unsigned int nonce, cGetWork *getWork, int workID ) {
-
-    submitLock.lock();
+//Submit thread only.  job is the snapshot the nonce was found on.
+void cSubmitter::sendNonce(unsigned int nonce, cGetWork *getWork, const cPreparedJob* job) {
 
     if (minerMode == "stratum") {
         char buf[4096];
         unsigned int* pNonce = &nonce;
         sprintf(buf, "{\"params\": [\"%s\", \"%s\", \"\", \"%s\", \"%s\"], \"id\": \"%d\", \"method\": \"mining.submit\"}",
-            rpcUser.c_str(), getWork->jobID.c_str(), getWork->timeHex.c_str(), makeHex((unsigned char*)pNonce, 4).c_str(), rpcSequence);
+            rpcUser.c_str(), job->jobID.c_str(), job->timeHex.c_str(), makeHex((unsigned char*)pNonce, 4).c_str(), rpcSequence);
 
         //printf("%s\n", buf);
 
@@ -188,7 +133,6 @@ void cSubmitter::submitNonce(unsigned int nonce, cGetWork *getWork, int workID )
         if (numSent < 0) {
             printf("Socket error on submit block\n");
             *socketError = true;
-            submitLock.unlock();
             return;
         }
         
@@ -199,10 +143,8 @@ void cSubmitter::submitNonce(unsigned int nonce, cGetWork *getWork, int workID )
     }
 
     else if (minerMode == "solo") {
-        getWork->lockJob.lock();
-
         unsigned char header[80];
-        memcpy(header, getWork->nativeData, 80);
+        memcpy(header, job->header, 80);
 
         memcpy(header + 76, &nonce, 4);
 
@@ -220,15 +162,7 @@ void cSubmitter::submitNonce(unsigned int nonce, cGetWork *getWork, int workID )
         char hexHeader[256];
         bin2hex(hexHeader, header, 80);
         strBlock += std::string(hexHeader);
-        strBlock += getWork->transactionString;
-
-        getWork->lockJob.unlock();
-
-        if (getWork->workID != workID) {
-            printf("Stale nonce, skipping\n");
-            submitLock.unlock();
-            return;
-        }
+        strBlock += job->transactionString;
 
         //printf("submit header: %s\n\n", hexHeader);
 
@@ -256,10 +190,8 @@ void cSubmitter::submitNonce(unsigned int nonce, cGetWork *getWork, int workID )
     }
 
     else if (minerMode == "pool") {
-        getWork->lockJob.lock();
-
         unsigned char header[80];
-        memcpy(header, getWork->nativeData, 80);
+        memcpy(header, job->header, 80);
 
         memcpy(header + 76, &nonce, 4);
 
@@ -275,9 +207,7 @@ void cSubmitter::submitNonce(unsigned int nonce, cGetWork *getWork, int workID )
         char hexHeader[256];
         bin2hex(hexHeader, header, 80);
         strBlock += std::string(hexHeader);
-        strBlock += getWork->transactionString;
-
-        getWork->lockJob.unlock();
+        strBlock += job->transactionString;
 
         string data = "{ \"command\" : \"submit\", \"data\" : \"" + strBlock + "\" }\n";        
 
@@ -294,9 +224,6 @@ void cSubmitter::submitNonce(unsigned int nonce, cGetWork *getWork, int workID )
 
         statDisplay->totalStats->share_count++;
     }
-
-    submitLock.unlock();
-    
 }
 
 
@@ -2,6 +2,9 @@
 #include <vector>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 #include "json.hpp"
 #include "difficulty.h"
 #include "struct.h"
@@ -16,6 +19,7 @@
 #endif
 
 class cGetWork;
+class cPreparedJob;
 class cStatDisplay;
 
 using namespace std;
@@ -23,41 +27,53 @@ using json = nlohmann::json;
 
 
 
-class cHashResult {
-public:
-	string jobID;
-	unsigned char* buffer;
-	uint32_t* nonceIndex;
-	//unsigned int startNonce;
-	int hashCount;
-	int deviceID;
+#define RESULT_QUEUE_SIZE 1024		//found nonces waiting for the submit thread, a power of 2
+
+//A nonce a miner found, waiting for the submit thread
+struct sFoundNonce
+{
+	uint32_t nonce;
+	const cPreparedJob* job;		//kept alive by its pendingSubmits count until it is sent
+	chrono::steady_clock::time_point found;
 };
 
-class cNonceEntry {
+//Bounded lock-free queue, a ring of cells with sequence numbers (Vyukov).  Any number of miner
+//threads push without locking or touching the heap, the submit thread pops.
+class cResultQueue
+{
 public:
-	string jobID;
-	unsigned int nonce;
+	cResultQueue();
+	bool push(const sFoundNonce& entry);		//false when full
+	bool pop(sFoundNonce& entry);				//submit thread only
+	bool ready() const;							//pop would succeed
+	uint32_t size() const { return enqueuePos.load(memory_order_relaxed) - dequeuePos.load(memory_order_relaxed); }
+
+	struct sCell
+	{
+		atomic<uint32_t> sequence;
+		sFoundNonce entry;
+	};
+	sCell cells[RESULT_QUEUE_SIZE];
+	atomic<uint32_t> enqueuePos;
+	atomic<uint32_t> dequeuePos;
 };
 
 class cSubmitter
 {
 public:
-	void submitEvalThread(cGetWork *getWork, cStatDisplay *iStatDisplay, string mode);
-	void submitNonceThread(cGetWork* getWork);
-	void submitNonce(unsigned int nonce, cGetWork* getWork, int workID);
+	void submitThread(cGetWork* getWork, cStatDisplay* iStatDisplay, string mode);
+	void submitNonce(unsigned int nonce, cGetWork* getWork, const cPreparedJob* job);
+	void sendNonce(unsigned int nonce, cGetWork* getWork, const cPreparedJob* job);
 	json execRPC(string data);
 	static size_t WriteMemoryCallback(void* contents, size_t size, size_t nmemb, void* userp);
 
-	void addHashResults(unsigned char* hashBuffer, int hashCount, string jobID, int deviceID, uint32_t* nonceIndex);
-	unsigned int countLeadingZeros(unsigned char* hash);
-
-	mutex submitLock;
-
-	mutex hashListLock;
-	vector<cHashResult*> hashList;
-
-	mutex nonceListLock;
-	vector<cNonceEntry*> nonceList;
+	cResultQueue results;
+	mutex wakeLock;						//only taken after a push and while the submit thread sleeps, never in the hash loop
+	condition_variable wake;
+	atomic<uint64_t> sentCount;
+	atomic<uint64_t> latencyMicros;		//found to sent, summed over sentCount
+	atomic<uint32_t> staleCount;		//the chain moved on before they were sent
+	atomic<uint32_t> droppedCount;		//the queue was full
 
 	int* stratumSocket;
 	int rpcSequence;
@@ -0,0 +1,319 @@
+#include "cThreadedVM.h"
+#include "cMiner.h"
+#include "cGetWork.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADED_INVALID 20		//handler slot for words that are not a complete instruction
+
+//words taken by each opcode, including the opcode itself
+static const uint32_t opWords[THREADED_INVALID] = {
+	9,	//ADD
+	9,	//XOR
+	1,	//SHA_SINGLE
+	2,	//SHA_LOOP
+	2,	//MEMGEN
+	9,	//MEMADD
+	9,	//MEMXOR
+	2,	//MEM_SELECT
+	1,	//END
+	3,	//READMEM2
+	2,	//LOOP
+	1,	//ENDLOOP
+	3,	//IF
+	1,	//STORETEMP
+	2,	//EXECOP
+	1,	//MEMADDHASHPREV
+	1,	//MEMXORHASHPREV
+	1,	//SUMBLOCK
+	17,	//MEMADDXOR
+	3	//MEMGEN_PARTIAL
+};
+
+const void* const* cThreadedVM::handlers = NULL;
+
+
+//Decode the instruction starting at every word.  The entry one past the end catches a program
+//that runs off its end.
+void cThreadedVM::decode(const vector<uint32_t>& byteCode, vector<sThreadedOp>& ops) {
+
+#ifdef THREADED_DISPATCH
+	if (handlers == NULL)
+		run(NULL, NULL, NULL, NULL, NULL);
+#endif
+
+	uint32_t size = byteCode.size();
+	ops.assign(size + 1, sThreadedOp());
+
+	for (uint32_t pos = 0; pos <= size; pos++) {
+		sThreadedOp& op = ops[pos];
+
+		uint32_t opcode = THREADED_INVALID;
+		if ((pos < size) && (byteCode[pos] < THREADED_INVALID) && (pos + opWords[byteCode[pos]] <= size))
+			opcode = byteCode[pos];
+
+		if (opcode == THREADED_INVALID)
+			op.next = size;
+		else {
+			op.next = pos + opWords[opcode];
+			if (opWords[opcode] >= 9)
+				memcpy(op.operand, &byteCode[pos + 1], (opWords[opcode] - 1) * 4);
+			else if (opWords[opcode] > 1)
+				op.arg = byteCode[pos + 1];
+			if (opcode == HASHOP_MEMGEN_PARTIAL)
+				op.operand[0] = byteCode[pos + 2];
+			if (opcode == HASHOP_IF)
+				op.taken = ((uint64_t)op.next + byteCode[pos + 2] < size) ? op.next + byteCode[pos + 2] : size;
+		}
+
+#ifdef THREADED_DISPATCH
+		op.handler = handlers[opcode];
+#else
+		op.handler = (const void*)(uintptr_t)opcode;
+#endif
+	}
+}
+
+
+#ifdef THREADED_DISPATCH
+#define HANDLER(label, opcode) label:
+#define DISPATCH() goto *op->handler
+#else
+#define HANDLER(label, opcode) case opcode:
+#define DISPATCH() goto dispatch
+#endif
+
+#define NEXT() { op = &code[op->next]; DISPATCH(); }
+
+
+void cThreadedVM::begin(const cPreparedJob* job, uint32_t nonce, uint32_t* hash, cMinerScratch* scratch, sThreadedResume* resume) {
+	scratch->pending.clear();
+
+	unsigned char tail[16];
+	memcpy(tail, &job->header[64], 12);
+	memcpy(&tail[12], &nonce, 4);
+	SHA256_80_Tail((unsigned char*)hash, job->midstate, tail);
+
+	if (resume != NULL)
+		memset(resume, 0, sizeof(sThreadedResume));
+}
+
+
+void cThreadedVM::runProgram(const cPreparedJob* job, uint32_t nonce, uint32_t* hash, cMinerScratch* scratch, const unsigned char* hashBlock) {
+	begin(job, nonce, hash, scratch, NULL);
+	run(job, hash, scratch, NULL, hashBlock);
+}
+
+
+//resume is NULL for a plain run from the start of the program that never stops at a SUMBLOCK
+bool cThreadedVM::run(const cPreparedJob* job, uint32_t* hash, cMinerScratch* scratch, sThreadedResume* resume, const unsigned char* hashBlock) {
+
+#ifdef THREADED_DISPATCH
+	static const void* const labels[THREADED_INVALID + 1] = {
+		&&op_add, &&op_xor, &&op_sha_single, &&op_sha_loop, &&op_memgen, &&op_memadd, &&op_memxor,
+		&&op_mem_select, &&op_end, &&op_readmem2, &&op_loop, &&op_endloop, &&op_if, &&op_storetemp,
+		&&op_execop, &&op_memaddhashprev, &&op_memxorhashprev, &&op_sumblock, &&op_memaddxor,
+		&&op_memgen_partial, &&op_invalid
+	};
+
+	if (job == NULL) {
+		handlers = labels;
+		return true;
+	}
+#endif
+
+	uint32_t* memGen = scratch->memGen;
+	uint32_t* tempStore = scratch->tempStore;
+	cMemTransforms& pending = scratch->pending;
+	const uint32_t* prevHashSHA = job->prevHashSHA;
+	const sThreadedOp* code = job->threadedCode.data();
+
+	uint32_t memSize = 0;
+	uint32_t loopCount = 0;
+	uint32_t loopStart = 0;
+
+	const sThreadedOp* op = code;
+	if (resume != NULL) {
+		memSize = resume->memSize;
+		loopCount = resume->loopCount;
+		loopStart = resume->loopStart;
+		op = &code[resume->pc];
+	}
+
+#ifndef THREADED_DISPATCH
+dispatch:
+	switch ((uintptr_t)op->handler) {
+#else
+	DISPATCH();
+#endif
+
+	HANDLER(op_add, HASHOP_ADD)
+		for (int j = 0; j < 8; j++)
+			hash[j] += op->operand[j];
+		NEXT();
+
+	HANDLER(op_xor, HASHOP_XOR)
+		for (int j = 0; j < 8; j++)
+			hash[j] ^= op->operand[j];
+		NEXT();
+
+	HANDLER(op_sha_single, HASHOP_SHA_SINGLE)
+		SHA256_32((unsigned char*)hash, (unsigned char*)hash);
+		NEXT();
+
+	HANDLER(op_sha_loop, HASHOP_SHA_LOOP)
+		for (uint32_t i = 0; i < op->arg; i++)
+			SHA256_32((unsigned char*)hash, (unsigned char*)hash);
+		NEXT();
+
+	HANDLER(op_memgen, HASHOP_MEMGEN)
+		memSize = op->arg;
+		pending.clear();
+		for (uint32_t i = 0; i < memSize; i++) {
+			SHA256_32((unsigned char*)hash, (unsigned char*)hash);
+			memcpy(&memGen[i * 8], hash, 32);
+		}
+		NEXT();
+
+	HANDLER(op_memgen_partial, HASHOP_MEMGEN_PARTIAL)
+		memSize = op->arg;
+		pending.clear();
+		for (uint32_t i = 0; i < op->operand[0]; i++) {
+			SHA256_32((unsigned char*)hash, (unsigned char*)hash);
+			memcpy(&memGen[i * 8], hash, 32);
+		}
+		NEXT();
+
+	//the memgen updates are only recorded, see cMemTransforms
+	HANDLER(op_memadd, HASHOP_MEMADD)
+		pending.push(op->operand, NULL, memGen, memSize);
+		NEXT();
+
+	HANDLER(op_memxor, HASHOP_MEMXOR)
+		pending.push(NULL, op->operand, memGen, memSize);
+		NEXT();
+
+	HANDLER(op_memaddxor, HASHOP_MEMADDXOR)
+		pending.push(op->operand, &op->operand[8], memGen, memSize);
+		NEXT();
+
+	HANDLER(op_mem_select, HASHOP_MEM_SELECT) {
+		uint32_t index = op->arg % memSize;
+		pending.read(&memGen[index * 8], hash);
+		NEXT();
+	}
+
+	HANDLER(op_end, HASHOP_END)
+		return true;
+
+	HANDLER(op_readmem2, HASHOP_READMEM2) {
+		if (op->arg == 0) {
+			for (int j = 0; j < 8; j++)
+				hash[j] ^= prevHashSHA[j];
+		}
+		else if (op->arg == 1) {
+			for (int j = 0; j < 8; j++)
+				hash[j] += prevHashSHA[j];
+		}
+
+		uint32_t index = 0;
+		for (int j = 0; j < 8; j++)
+			index += hash[j];
+		index = index % memSize;
+
+		pending.read(&memGen[index * 8], hash);
+		NEXT();
+	}
+
+	HANDLER(op_loop, HASHOP_LOOP) {
+		uint32_t sum = 0;
+		for (int j = 0; j < 8; j++)
+			sum += hash[j];
+		loopCount = sum % op->arg + 1;
+		loopStart = op->next;
+		NEXT();
+	}
+
+	HANDLER(op_endloop, HASHOP_ENDLOOP)
+		loopCount--;
+		op = &code[(loopCount > 0) ? loopStart : op->next];
+		DISPATCH();
+
+	HANDLER(op_if, HASHOP_IF) {
+		uint32_t sum = 0;
+		for (int j = 0; j < 8; j++)
+			sum += hash[j];
+		op = &code[(sum % op->arg == 0) ? op->taken : op->next];
+		DISPATCH();
+	}
+
+	HANDLER(op_storetemp, HASHOP_STORETEMP)
+		memcpy(tempStore, hash, 32);
+		NEXT();
+
+	HANDLER(op_execop, HASHOP_EXECOP) {
+		uint32_t sum = 0;
+		for (int j = 0; j < 8; j++)
+			sum += hash[j];
+
+		if (sum % 3 == 0) {
+			for (int j = 0; j < 8; j++)
+				hash[j] += tempStore[j];
+		}
+		else if (sum % 3 == 1) {
+			for (int j = 0; j < 8; j++)
+				hash[j] ^= tempStore[j];
+		}
+		else
+			SHA256_32((unsigned char*)hash, (unsigned char*)hash);
+		NEXT();
+	}
+
+	HANDLER(op_memaddhashprev, HASHOP_MEMADDHASHPREV) {
+		uint32_t v[8];
+		for (int j = 0; j < 8; j++)
+			v[j] = hash[j] + prevHashSHA[j];
+		pending.push(v, NULL, memGen, memSize);
+		NEXT();
+	}
+
+	HANDLER(op_memxorhashprev, HASHOP_MEMXORHASHPREV)
+		pending.push(hash, prevHashSHA, memGen, memSize);
+		NEXT();
+
+	HANDLER(op_sumblock, HASHOP_SUMBLOCK) {
+		uint64_t row = (hash[0] + hash[1] + hash[2] + hash[3]) % 3072;
+		uint64_t col = (hash[4] + hash[5] + hash[6] + hash[7]) % 32768;
+		uint64_t index = row * 32768 + col;
+		const uint64_t hashBlockSize = 1024ULL * 1024ULL * 3072ULL;
+
+		//the 256 bytes span at most 5 cache lines
+		if ((resume != NULL) && !resume->prefetched) {
+			for (int i = 0; i < 256; i += 64)
+				PREFETCH(&hashBlock[index + i]);
+			PREFETCH(&hashBlock[index + 255]);
+			resume->pc = op - code;
+			resume->memSize = memSize;
+			resume->loopCount = loopCount;
+			resume->loopStart = loopStart;
+			resume->prefetched = true;
+			return false;
+		}
+		if (resume != NULL)
+			resume->prefetched = false;
+
+		for (int i = 0; i < 256; i++)
+			hash[i % 8] += hashBlock[(index + i) % hashBlockSize];
+		NEXT();
+	}
+
+	HANDLER(op_invalid, THREADED_INVALID)
+		printf("Invalid instruction at word %d of the hash program\n", (int)(op - code));
+		exit(0);
+
+#ifndef THREADED_DISPATCH
+	}
+	return true;
+#endif
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+#include "sha256.h"
+
+class cPreparedJob;
+class cMinerScratch;
+
+using namespace std;
+
+//GCC and clang can take the address of a label, so each handler jumps straight to the next one.
+//Other compilers (or -DNO_THREADED_DISPATCH) get the same handlers behind a switch.
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+//pull a hash block line into the cache ahead of SUMBLOCK
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#endif
+
+//One pre-decoded instruction.  The operands are copied out of the bytecode and the lines that
+//follow are resolved to indexes, so the interpreter never looks at byteCode again.
+struct sThreadedOp
+{
+	const void* handler;		//address of the op's handler, or the opcode with the switch fallback
+	uint32_t arg;				//SHA_LOOP/MEMGEN/LOOP count, MEM_SELECT index, READMEM2 mode, IF modulus
+	uint32_t next;				//op that runs after this one
+	uint32_t taken;				//IF - op that runs when the condition holds
+	uint32_t operand[16];		//ADD/XOR/MEMADD/MEMXOR, MEMADDXOR uses all 16, MEMGEN_PARTIAL rows
+};
+
+//Registers of a nonce that stopped at a SUMBLOCK, see cThreadedVM::run
+struct sThreadedResume
+{
+	uint32_t pc;				//op to continue at
+	uint32_t memSize;
+	uint32_t loopCount;
+	uint32_t loopStart;
+	bool prefetched;			//the SUMBLOCK at pc has prefetched its row
+};
+
+//Scalar interpreter that runs the pre-decoded form of the hash program.  There is one entry per
+//bytecode word, so an IF that skips into the middle of an instruction still lands on the same
+//word the old interpreter would decode next.
+class cThreadedVM
+{
+public:
+	static void decode(const vector<uint32_t>& byteCode, vector<sThreadedOp>& ops);
+	static void runProgram(const cPreparedJob* job, uint32_t nonce, uint32_t* hash, cMinerScratch* scratch, const unsigned char* hashBlock);
+
+	//Pipelined form: begin() hashes the header, then each run() goes on until the program ends
+	//(returns true) or reaches a SUMBLOCK.  There it prefetches the hash block row and returns
+	//false, so the caller can run other nonces while the row arrives, and the next run() sums it.
+	static void begin(const cPreparedJob* job, uint32_t nonce, uint32_t* hash, cMinerScratch* scratch, sThreadedResume* resume);
+	static bool run(const cPreparedJob* job, uint32_t* hash, cMinerScratch* scratch, sThreadedResume* resume, const unsigned char* hashBlock);
+
+private:
+	static const void* const* handlers;		//handler addresses by opcode, published by runProgram(NULL, ...)
+};
@@ -0,0 +1,168 @@
+#include "cTopology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+
+cTopology::cTopology() {
+	physicalCores = 0;
+	mode = "off";
+}
+
+
+#ifdef __linux__
+static bool readLine(const string& path, string& line) {
+	FILE* f = fopen(path.c_str(), "r");
+	if (f == NULL)
+		return false;
+	char buf[4096];
+	bool ok = (fgets(buf, sizeof(buf), f) != NULL);
+	fclose(f);
+	if (ok)
+		line = buf;
+	return ok;
+}
+
+//sysfs cpu lists look like "0-3,8-11"
+static vector<int> parseList(const string& list) {
+	vector<int> ids;
+	const char* p = list.c_str();
+	while (*p != 0) {
+		char* end;
+		long first = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		long last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (long i = first; i <= last; i++)
+			ids.push_back(i);
+		if (*p == ',')
+			p++;
+	}
+	return ids;
+}
+#endif
+
+
+void cTopology::discover() {
+
+	cpus.clear();
+	nodeIds.clear();
+	physicalCores = 0;
+
+#ifdef __linux__
+	string line;
+	if (!readLine("/sys/devices/system/cpu/online", line))
+		return;
+	vector<int> online = parseList(line);
+
+	//cpus without a node directory (no NUMA support in the kernel) all go to node 0
+	map<int, int> cpuNode;
+	if (readLine("/sys/devices/system/node/online", line)) {
+		vector<int> nodes = parseList(line);
+		for (size_t n = 0; n < nodes.size(); n++) {
+			char path[128];
+			sprintf(path, "/sys/devices/system/node/node%d/cpulist", nodes[n]);
+			if (!readLine(path, line))
+				continue;
+			vector<int> nodeCpus = parseList(line);
+			if (nodeCpus.empty())
+				continue;		//memory only node
+			for (size_t i = 0; i < nodeCpus.size(); i++)
+				cpuNode[nodeCpus[i]] = nodeIds.size();
+			nodeIds.push_back(nodes[n]);
+		}
+	}
+	if (nodeIds.empty())
+		nodeIds.push_back(0);
+
+	map<pair<int, int>, int> coreIndex;		//(package, core_id) -> physical core
+	for (size_t i = 0; i < online.size(); i++) {
+		char path[128];
+		cLogicalCpu cpu;
+		cpu.id = online[i];
+		cpu.node = cpuNode.count(cpu.id) ? cpuNode[cpu.id] : 0;
+
+		int package = 0, coreId = cpu.id;
+		sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu.id);
+		if (readLine(path, line))
+			package = atoi(line.c_str());
+		sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu.id);
+		if (readLine(path, line))
+			coreId = atoi(line.c_str());
+
+		pair<int, int> key(package, coreId);
+		cpu.primary = (coreIndex.count(key) == 0);
+		if (cpu.primary)
+			coreIndex[key] = physicalCores++;
+		cpu.core = coreIndex[key];
+
+		cpus.push_back(cpu);
+	}
+#endif
+}
+
+
+vector<int> cTopology::placement() const {
+
+	vector<int> order;
+	for (int pass = 0; pass < 2; pass++) {
+		bool primary = (pass == 0);
+
+		vector<vector<int>> perNode(nodeIds.size());
+		for (size_t i = 0; i < cpus.size(); i++)
+			if (cpus[i].primary == primary)
+				perNode[cpus[i].node].push_back(cpus[i].id);
+
+		//nodes take turns so a partial thread count still spreads over every node
+		for (size_t k = 0; ; k++) {
+			bool added = false;
+			for (size_t n = 0; n < perNode.size(); n++)
+				if (k < perNode[n].size()) {
+					order.push_back(perNode[n][k]);
+					added = true;
+				}
+			if (!added)
+				break;
+		}
+	}
+	return order;
+}
+
+
+int cTopology::nodeOf(int cpu) const {
+	for (size_t i = 0; i < cpus.size(); i++)
+		if (cpus[i].id == cpu)
+			return cpus[i].node;
+	return 0;
+}
+
+
+bool cTopology::pinThread(int cpu) {
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	if (cpu >= 64)
+		return false;
+	return SetThreadAffinityMask(GetCurrentThread(), 1ULL << cpu) != 0;
+#else
+	return false;
+#endif
+}
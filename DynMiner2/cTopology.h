@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+//One logical CPU as sysfs describes it
+class cLogicalCpu
+{
+public:
+	int id;
+	int core;			//physical core, unique across packages
+	int node;			//index into cTopology::nodeIds
+	bool primary;		//lowest numbered SMT sibling of its core
+};
+
+//CPU and NUMA layout from /sys/devices/system, used to pin CPU miner threads and to give each
+//node its own copy of the hash block.  Outside Linux, or without sysfs, cpus stays empty and
+//nothing is pinned.
+class cTopology
+{
+public:
+	cTopology();
+
+	void discover();
+
+	//CPUs in the order miner threads are pinned to them: one thread per physical core first, the
+	//cores taken from the nodes in turn, then the SMT siblings
+	vector<int> placement() const;
+
+	int nodeOf(int cpu) const;
+
+	//pin the calling thread to one logical CPU
+	static bool pinThread(int cpu);
+
+	vector<cLogicalCpu> cpus;
+	vector<int> nodeIds;				//sysfs node numbers, which can have gaps
+	uint32_t physicalCores;
+
+	string mode;						//-numa off, pin, interleave or replicate
+	vector<unsigned char*> nodeBlocks;	//hash block the threads of each node read, the same one unless replicate
+};
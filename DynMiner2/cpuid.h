@@ -5,20 +5,16 @@
 #ifndef BITCOIN_COMPAT_CPUID_H
 #define BITCOIN_COMPAT_CPUID_H
 
-#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && defined(__GNUC__)
 #define HAVE_GETCPUID
 
-#include <cpuid.h>
+#include <stdint.h>
 
-// We can't use cpuid.h's __get_cpuid as it does not support subleafs.
+// The compiler's <cpuid.h> is shadowed by this file when building with -I., so issue cpuid directly.
 void static inline GetCPUID(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
 {
-#ifdef __GNUC__
-    __cpuid_count(leaf, subleaf, a, b, c, d);
-#else
-  __asm__ ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "0"(leaf), "2"(subleaf));
-#endif
+    __asm__ ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "0"(leaf), "2"(subleaf));
 }
 
-#endif // defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#endif // (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && defined(__GNUC__)
 #endif // BITCOIN_COMPAT_CPUID_H
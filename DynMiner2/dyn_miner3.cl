@@ -296,6 +296,8 @@ static void sha256 ( uint pass_len,  const unsigned int *pass,  uint *hash)
     return;                 
 }
 
+#define SHA256_COMPRESS sha256_process2
+
 #else
 
 #define H0 0x6a09e667
@@ -547,9 +549,34 @@ static void sha256 ( uint pass_len,  const unsigned int *pass,  uint *hash)
 	else SHA2_256_80(pass, hash);
 }
 
+#define SHA256_COMPRESS sha256_round
+
 #endif
 
 
+//finish the header hash from the host computed midstate, only the last 16 bytes (ending in the nonce) change per hash
+static void sha256_80_tail(__global const uint* midstate, const uint* tail, uint* hash)
+{
+	uint W[16];
+	uint State[8];
+
+	for (int i = 0; i < 8; i++)
+		State[i] = midstate[i];
+
+	for (int i = 0; i < 4; i++)
+		W[i] = SWAP(tail[i]);
+	W[4] = 0x80000000;
+	for (int i = 5; i < 15; i++)
+		W[i] = 0;
+	W[15] = 80 * 8;
+
+	SHA256_COMPRESS(W, State);
+
+	for (int i = 0; i < 8; i++)
+		hash[i] = SWAP(State[i]);
+}
+
+
 
 
 
@@ -594,19 +621,85 @@ static inline uint CLZz(uint x)
 #define HASHOP_MEMADDHASHPREV 15
 #define HASHOP_MEMXORHASHPREV 16
 #define HASHOP_SUMBLOCK 17
+#define HASHOP_MEMADDXOR 18
+#define HASHOP_MEMGEN_PARTIAL 19
 
 #define SWAP32(x)	as_uint(as_uchar4(x).s3210)
 
-__kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __global uint* hostHeader, __global uint* NonceRetBuf, const ulong target, __global uint* global_memgen, __global uint* global_hashblock) {
+//MEMADD, MEMXOR, MEMADDXOR and the *HASHPREV ops change every memgen row the same way, per column
+//row = (row + add) ^ xor.  They are kept in a short private list and replayed on the row that
+//MEM_SELECT/READMEM2 reads, so memgen in global memory is only written by MEMGEN.
+#define MEMGEN_PENDING 8
+
+//write the pending transforms through to every row, when the list is full
+void memgen_apply(__global uint* memGen, uint memSize, uint* pendAdd, uint* pendXor, uint pendCount) {
+    for (uint i = 0; i < memSize; i++)
+        for (int j = 0; j < 8; j++) {
+            uint v = memGen[i * 8 + j];
+            for (uint k = 0; k < pendCount; k++)
+                v = (v + pendAdd[k * 8 + j]) ^ pendXor[k * 8 + j];
+            memGen[i * 8 + j] = v;
+        }
+}
+
+//record row = (row + a) ^ x.  (row + a1) ^ x1 followed by ^ x2, or by + a2 when x1 is zero,
+//folds into the last entry.
+void memgen_push(__global uint* memGen, uint memSize, uint* pendAdd, uint* pendXor, uint* pendCount, uint* lastXor, uint* a, uint* x) {
+    uint hasAdd = 0;
+    uint hasXor = 0;
+    for (int j = 0; j < 8; j++) {
+        hasAdd |= a[j];
+        hasXor |= x[j];
+    }
+
+    if ((*pendCount > 0) && ((hasAdd == 0) || (*lastXor == 0))) {
+        uint last = *pendCount - 1;
+        for (int j = 0; j < 8; j++) {
+            pendAdd[last * 8 + j] += a[j];
+            pendXor[last * 8 + j] ^= x[j];
+        }
+        *lastXor |= hasXor;
+        return;
+    }
+
+    if (*pendCount == MEMGEN_PENDING) {
+        memgen_apply(memGen, memSize, pendAdd, pendXor, *pendCount);
+        *pendCount = 0;
+    }
+
+    for (int j = 0; j < 8; j++) {
+        pendAdd[*pendCount * 8 + j] = a[j];
+        pendXor[*pendCount * 8 + j] = x[j];
+    }
+    *lastXor = hasXor;
+    (*pendCount)++;
+}
+
+//the current value of a row
+void memgen_read(__global uint* memGen, uint index, uint* pendAdd, uint* pendXor, uint pendCount, uint* out) {
+    for (int j = 0; j < 8; j++) {
+        uint v = memGen[index * 8 + j];
+        for (uint k = 0; k < pendCount; k++)
+            v = (v + pendAdd[k * 8 + j]) ^ pendXor[k * 8 + j];
+        out[j] = v;
+    }
+}
+
+//NonceRetBuf: found nonces at 0-0xFE, their count at 0xFF, nonces skipped after an abort at 0x100.
+//hashResult: per work item the first nonce it hashed and how many, for -nonceaudit.
+//abortFlag is set by the miner through a second queue when the job changes, the work items stop
+//between loops - if the runtime lets a running kernel see the write.
+__kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __global uint* hostHeader, __global uint* NonceRetBuf, const ulong target, __global uint* global_memgen, __global uint* global_hashblock, __global volatile uint* abortFlag) {
     
     int computeUnitID = get_global_id(0) - get_global_offset(0);
 
-    __global uint* hostHashResult = &hashResult[computeUnitID * 8];
+    __global uint* itemCoverage = &hashResult[computeUnitID * 2];
 
     uint myHeader[20];
     uint myHashResult[8];
 
-    uint nonce = get_global_id(0) * GPU_LOOPS;
+    uint nonce = get_global_offset(0) + computeUnitID * GPU_LOOPS;
+    itemCoverage[0] = nonce;
 
     for ( int i = 0; i < 19; i++)
         myHeader[i] = hostHeader[i];
@@ -618,16 +711,32 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
     uint bestHash[8];
 
 
+    //header layout: 20 words of block header, 8 words of midstate, 8 words of prevHash SHA
     uint prevHashSHA[8];
-    sha256(32, &myHeader[1], prevHashSHA);
+    for (int i = 0; i < 8; i++)
+        prevHashSHA[i] = hostHeader[28 + i];
 
     __global uint* myMemGen = &global_memgen[computeUnitID * 512 * 8];
     uint tempStore[8];
+
+    uint pendAdd[MEMGEN_PENDING * 8];
+    uint pendXor[MEMGEN_PENDING * 8];
+    uint pendCount;
+    uint lastXor;
+    uint zero[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint opA[8];
+    uint opX[8];
     
     
     uint hashCount = 0;
     while (hashCount < GPU_LOOPS) {
 
+        //the nonces left are for a job that has been replaced
+        if (*abortFlag != 0) {
+            atomic_add(NonceRetBuf + 0x100, GPU_LOOPS - hashCount);
+            break;
+        }
+
         /*
         if (get_global_id(0) != 0)
             return;
@@ -639,7 +748,7 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
         printf("\n");
         */
 
-            sha256(80, myHeader, myHashResult);
+            sha256_80_tail(&hostHeader[20], &myHeader[16], myHashResult);
 
 
 
@@ -647,6 +756,7 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
             uint done = 0;
             uint currentMemSize = 0;
             uint instruction = 0;
+            pendCount = 0;
 
             uint loop_opcode_count;
             uint loop_line_ptr;
@@ -703,6 +813,7 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
                     linePtr++;
 
                     currentMemSize = byteCode[linePtr];
+                    pendCount = 0;
 
                     for (int i = 0; i < currentMemSize; i++) {
                         sha256(32, myHashResult, myHashResult);
@@ -714,13 +825,27 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
                     linePtr++;
                 }
 
+                //MEMGEN whose rows past the last one MEM_SELECT reads are never used
+                else if (byteCode[linePtr] == HASHOP_MEMGEN_PARTIAL) {
+                    currentMemSize = byteCode[linePtr + 1];
+                    pendCount = 0;
+
+                    for (int i = 0; i < byteCode[linePtr + 2]; i++) {
+                        sha256(32, myHashResult, myHashResult);
+                        for (int j = 0; j < 8; j++)
+                            myMemGen[i*8+j] = myHashResult[j];
+                    }
+
+                    linePtr += 3;
+                }
+
 
                 else if (byteCode[linePtr] == HASHOP_MEMADD) {
                     linePtr++;
 
-                    for (int i = 0; i < currentMemSize; i++)
-                        for (int j = 0; j < 8; j++)
-                            myMemGen[i*8+j] += byteCode[linePtr + j];
+                    for (int j = 0; j < 8; j++)
+                        opA[j] = byteCode[linePtr + j];
+                    memgen_push(myMemGen, currentMemSize, pendAdd, pendXor, &pendCount, &lastXor, opA, zero);
 
                     linePtr += 8;
                 }
@@ -728,10 +853,9 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
                 else if (byteCode[linePtr] == HASHOP_MEMADDHASHPREV) {
                     linePtr++;
 
-                    for (int i = 0; i < currentMemSize; i++)
-                        for (int j = 0; j < 8; j++) {
-                            myMemGen[i * 8 + j] += myHashResult[j] + prevHashSHA[j];
-                        }
+                    for (int j = 0; j < 8; j++)
+                        opA[j] = myHashResult[j] + prevHashSHA[j];
+                    memgen_push(myMemGen, currentMemSize, pendAdd, pendXor, &pendCount, &lastXor, opA, zero);
 
                 }
 
@@ -739,21 +863,29 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
                 else if (byteCode[linePtr] == HASHOP_MEMXOR) {
                     linePtr++;
 
-                    for (int i = 0; i < currentMemSize; i++)
-                        for (int j = 0; j < 8; j++)
-                            myMemGen[i * 8 + j] ^= byteCode[linePtr + j];
+                    for (int j = 0; j < 8; j++)
+                        opX[j] = byteCode[linePtr + j];
+                    memgen_push(myMemGen, currentMemSize, pendAdd, pendXor, &pendCount, &lastXor, zero, opX);
 
                     linePtr += 8;
                 }
 
+                else if (byteCode[linePtr] == HASHOP_MEMADDXOR) {
+                    linePtr++;
+
+                    for (int j = 0; j < 8; j++) {
+                        opA[j] = byteCode[linePtr + j];
+                        opX[j] = byteCode[linePtr + 8 + j];
+                    }
+                    memgen_push(myMemGen, currentMemSize, pendAdd, pendXor, &pendCount, &lastXor, opA, opX);
+
+                    linePtr += 16;
+                }
+
                 else if (byteCode[linePtr] == HASHOP_MEMXORHASHPREV) {
                     linePtr++;
 
-                    for (int i = 0; i < currentMemSize; i++)
-                        for (int j = 0; j < 8; j++) {
-                            myMemGen[i * 8 + j] += myHashResult[j];
-                            myMemGen[i * 8 + j] ^= prevHashSHA[j];
-                        }
+                    memgen_push(myMemGen, currentMemSize, pendAdd, pendXor, &pendCount, &lastXor, myHashResult, prevHashSHA);
 
                 }
 
@@ -761,8 +893,7 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
                 else if (byteCode[linePtr] == HASHOP_MEM_SELECT) {
                     linePtr++;
                     uint index = byteCode[linePtr] % currentMemSize;
-                    for (int j = 0; j < 8; j++)
-                        myHashResult[j] = myMemGen[index*8 + j];
+                    memgen_read(myMemGen, index, pendAdd, pendXor, pendCount, myHashResult);
 
                     linePtr++;
                 }
@@ -787,8 +918,7 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
 
                     index = index % currentMemSize;
 
-                    for (int j = 0; j < 8; j++)
-                        myHashResult[j] = myMemGen[index*8+j];
+                    memgen_read(myMemGen, index, pendAdd, pendXor, pendCount, myHashResult);
 
                     linePtr++;
 
@@ -959,8 +1089,10 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
                 );
               */
 
-			NonceRetBuf[atomic_inc(NonceRetBuf + 0xFF)] = nonce;
-			break;	// we are solo mining, any other solutions will go to waste anyhow
+			//the work item goes on with its other nonces, they are counted as hashed
+			uint slot = atomic_inc(NonceRetBuf + 0xFF);
+			if (slot < 0xFF)
+				NonceRetBuf[slot] = nonce;
 		}
         
 		
@@ -969,4 +1101,6 @@ __kernel void dyn_hash (__global uint* byteCode, __global uint* hashResult, __gl
         myHeader[19] = nonce;
 	}
 
+    itemCoverage[1] = hashCount;
+
 }
@@ -0,0 +1,144 @@
+// Memgen row kernels and their runtime dispatch.  The AVX2 and AVX-512 versions live in their
+// own files, each built for its instruction set (see Makefile).
+
+#include "memgen_rows.h"
+#include "cpuid.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+typedef void (*tRowsTransform)(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n);
+
+namespace memgen_rows_avx2
+{
+void Transform(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n);
+}
+
+namespace memgen_rows_avx512
+{
+void Transform(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n);
+}
+
+namespace
+{
+namespace memgen_rows
+{
+void Transform(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t* row = &rows[i * 8];
+        for (uint32_t k = 0; k < n; k++)
+            for (int j = 0; j < 8; j++)
+                row[j] = (row[j] + add[k][j]) ^ xorValue[k][j];
+    }
+}
+} // namespace memgen_rows
+
+tRowsTransform RowsTransform = memgen_rows::Transform;
+
+const uint32_t zeroRow[8] = {};
+
+/** Run each kernel on a few rows against the scalar one. */
+bool SelfTest()
+{
+    uint32_t add[3][8], xorValue[3][8];
+    uint32_t rows[7 * 8], expect[7 * 8];
+    uint32_t x = 0x9e3779b9;
+    for (int i = 0; i < 7 * 8; i++)
+        rows[i] = (x = x * 1664525 + 1013904223);
+    for (int k = 0; k < 3; k++)
+        for (int j = 0; j < 8; j++) {
+            add[k][j] = (x = x * 1664525 + 1013904223);
+            xorValue[k][j] = (x = x * 1664525 + 1013904223);
+        }
+
+    memcpy(expect, rows, sizeof(rows));
+    memgen_rows::Transform(expect, 7, add, xorValue, 3);
+    RowsTransform(rows, 7, add, xorValue, 3);
+    return memcmp(rows, expect, sizeof(rows)) == 0;
+}
+
+#if defined(HAVE_GETCPUID) && (defined(ENABLE_AVX2) || defined(ENABLE_AVX512))
+/** Check which vector registers the OS saves: bits 1-2 for AVX, 5-7 for AVX-512. */
+uint32_t EnabledXSave()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return a;
+}
+#endif
+} // namespace
+
+
+std::string MemRowsAutoDetect(const std::string& force)
+{
+    std::string ret = "standard";
+    RowsTransform = memgen_rows::Transform;
+
+#if defined(HAVE_GETCPUID) && (defined(ENABLE_AVX2) || defined(ENABLE_AVX512))
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t xsave = 0;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    bool have_xsave = (ecx >> 27) & 1;
+    bool have_avx = (ecx >> 28) & 1;
+    ebx = 0;
+    if (have_xsave && have_avx) {
+        xsave = EnabledXSave();
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+    }
+
+#if defined(ENABLE_AVX2)
+    bool have_avx2 = ((xsave & 0x06) == 0x06) && ((ebx >> 5) & 1) && (force != "standard");
+    if (have_avx2) {
+        RowsTransform = memgen_rows_avx2::Transform;
+        ret = "avx2";
+    }
+#endif
+#if defined(ENABLE_AVX512)
+    bool have_avx512 = ((xsave & 0xe6) == 0xe6) && ((ebx >> 16) & 1) && (force != "standard") && (force != "avx2");
+    if (have_avx512) {
+        RowsTransform = memgen_rows_avx512::Transform;
+        ret = "avx512";
+    }
+#endif
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
+
+void MemRowsTransform(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n)
+{
+    RowsTransform(rows, count, add, xorValue, n);
+}
+
+void MemRowsTransform1(uint32_t* rows, uint32_t count, const uint32_t* add, const uint32_t* xorValue)
+{
+    RowsTransform(rows, count, (const uint32_t (*)[8])(add ? add : zeroRow), (const uint32_t (*)[8])(xorValue ? xorValue : zeroRow), 1);
+}
+
+void* MemRowsAlloc(size_t size)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, MEMGEN_ALIGN);
+#else
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, MEMGEN_ALIGN, size) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+void MemRowsFree(void* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
@@ -0,0 +1,32 @@
+#ifndef DYNMINER_MEMGEN_ROWS_H
+#define DYNMINER_MEMGEN_ROWS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/** Alignment of the memgen buffers, one AVX-512 register or two 32-byte rows. */
+#define MEMGEN_ALIGN 64
+
+/** Pick the widest memgen row kernels the CPU supports.
+ *  force ("standard", "avx2" or "avx512", the -memgen argument) caps the choice: standard stays
+ *  scalar, avx2 stops short of AVX-512.
+ *  Returns the name of the implementation.
+ */
+std::string MemRowsAutoDetect(const std::string& force = "");
+
+/** Apply n row transforms to count 32-byte memgen rows, in order:
+ *  row = (row + add[k]) ^ xorValue[k] for k = 0 .. n-1, per 32-bit column.
+ *  This is the eager path - MEMADD, MEMXOR and friends over every row, or the replay of
+ *  the transforms cMemTransforms held back.
+ */
+void MemRowsTransform(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n);
+
+/** One transform, add or xorValue may be NULL. */
+void MemRowsTransform1(uint32_t* rows, uint32_t count, const uint32_t* add, const uint32_t* xorValue);
+
+/** MEMGEN_ALIGN aligned heap blocks for the memgen buffers. */
+void* MemRowsAlloc(size_t size);
+void MemRowsFree(void* ptr);
+
+#endif // DYNMINER_MEMGEN_ROWS_H
@@ -0,0 +1,44 @@
+// Memgen row transforms, one 32-byte row per AVX2 register.
+// Built with -mavx -mavx2 (see Makefile) and only called when the CPU supports it.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+namespace memgen_rows_avx2 {
+
+void Transform(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n)
+{
+    __m256i* p = (__m256i*)rows;
+
+    /** The buffers are MEMGEN_ALIGN aligned, so the unaligned loads cost nothing and the
+     *  kernel still works on any row pointer.
+     *  The common case - one MEMADD/MEMXOR - keeps both operands in registers. */
+    if (n == 1) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)add[0]);
+        __m256i x = _mm256_loadu_si256((const __m256i*)xorValue[0]);
+        uint32_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            __m256i r0 = _mm256_loadu_si256(&p[i]);
+            __m256i r1 = _mm256_loadu_si256(&p[i + 1]);
+            _mm256_storeu_si256(&p[i], _mm256_xor_si256(_mm256_add_epi32(r0, a), x));
+            _mm256_storeu_si256(&p[i + 1], _mm256_xor_si256(_mm256_add_epi32(r1, a), x));
+        }
+        if (i < count)
+            _mm256_storeu_si256(&p[i], _mm256_xor_si256(_mm256_add_epi32(_mm256_loadu_si256(&p[i]), a), x));
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        __m256i r = _mm256_loadu_si256(&p[i]);
+        for (uint32_t k = 0; k < n; k++)
+            r = _mm256_xor_si256(_mm256_add_epi32(r, _mm256_loadu_si256((const __m256i*)add[k])), _mm256_loadu_si256((const __m256i*)xorValue[k]));
+        _mm256_storeu_si256(&p[i], r);
+    }
+}
+
+}
+
+#endif
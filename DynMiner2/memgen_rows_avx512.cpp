@@ -0,0 +1,51 @@
+// Memgen row transforms, two 32-byte rows per AVX-512 register.
+// Built with -mavx512f (see Makefile) and only called when the CPU supports it.
+
+#ifdef ENABLE_AVX512
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+namespace memgen_rows_avx512 {
+namespace {
+
+/** The same 32-byte row in both halves. */
+__m512i inline Row2(const uint32_t* row) { return _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*)row)); }
+
+}
+
+void Transform(uint32_t* rows, uint32_t count, const uint32_t (*add)[8], const uint32_t (*xorValue)[8], uint32_t n)
+{
+    uint32_t pairs = count / 2;
+
+    if (n == 1) {
+        __m512i a = Row2(add[0]);
+        __m512i x = Row2(xorValue[0]);
+        for (uint32_t i = 0; i < pairs; i++) {
+            __m512i r = _mm512_loadu_si512(&rows[i * 16]);
+            _mm512_storeu_si512(&rows[i * 16], _mm512_xor_si512(_mm512_add_epi32(r, a), x));
+        }
+    }
+    else {
+        for (uint32_t i = 0; i < pairs; i++) {
+            __m512i r = _mm512_loadu_si512(&rows[i * 16]);
+            for (uint32_t k = 0; k < n; k++)
+                r = _mm512_xor_si512(_mm512_add_epi32(r, Row2(add[k])), Row2(xorValue[k]));
+            _mm512_storeu_si512(&rows[i * 16], r);
+        }
+    }
+
+    /** An odd last row is the low half of a masked register. */
+    if (count & 1) {
+        uint32_t* last = &rows[pairs * 16];
+        __m512i r = _mm512_maskz_loadu_epi32(0x00ff, last);
+        for (uint32_t k = 0; k < n; k++)
+            r = _mm512_xor_si512(_mm512_add_epi32(r, Row2(add[k])), Row2(xorValue[k]));
+        _mm512_mask_storeu_epi32(last, 0x00ff, r);
+    }
+}
+
+}
+
+#endif
@@ -9,7 +9,9 @@
 #include <assert.h>
 #include <string.h>
 
-//#include "cpuid.h"
+#include <algorithm>
+
+#include "cpuid.h"
 
 #if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
 #if defined(USE_ASM)
@@ -38,6 +40,18 @@ void Transform_2way(unsigned char* out, const unsigned char* in);
 namespace sha256_shani
 {
 void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+void Transform32(unsigned char* out, const unsigned char* in);
+void Transform32_2way(unsigned char* out, const unsigned char* in);
+}
+
+namespace sha256_sse41
+{
+void Transform32_4way(uint32_t* words, size_t stride);
+}
+
+namespace sha256_avx2
+{
+void Transform32_8way(uint32_t* words, size_t stride);
 }
 
 // Internal implementation code.
@@ -413,6 +427,175 @@ void TransformD64(unsigned char* out, const unsigned char* in)
     WriteBE32(out + 28, h + 0x5be0cd19ul);
 }
 
+/** SHA-256 of a single 32-byte message.  Words 8-15 are always the same padding, so they are
+ *  folded into the round constants and the message schedule (same as Transform 3 above).
+ */
+void Transform32(unsigned char* out, const unsigned char* in)
+{
+    uint32_t a = 0x6a09e667ul;
+    uint32_t b = 0xbb67ae85ul;
+    uint32_t c = 0x3c6ef372ul;
+    uint32_t d = 0xa54ff53aul;
+    uint32_t e = 0x510e527ful;
+    uint32_t f = 0x9b05688cul;
+    uint32_t g = 0x1f83d9abul;
+    uint32_t h = 0x5be0cd19ul;
+
+    uint32_t w0 = ReadBE32(in + 0);
+    uint32_t w1 = ReadBE32(in + 4);
+    uint32_t w2 = ReadBE32(in + 8);
+    uint32_t w3 = ReadBE32(in + 12);
+    uint32_t w4 = ReadBE32(in + 16);
+    uint32_t w5 = ReadBE32(in + 20);
+    uint32_t w6 = ReadBE32(in + 24);
+    uint32_t w7 = ReadBE32(in + 28);
+    uint32_t w8, w9, w10, w11, w12, w13, w14, w15;
+
+    Round(a, b, c, d, e, f, g, h, 0x428a2f98ul + w0);
+    Round(h, a, b, c, d, e, f, g, 0x71374491ul + w1);
+    Round(g, h, a, b, c, d, e, f, 0xb5c0fbcful + w2);
+    Round(f, g, h, a, b, c, d, e, 0xe9b5dba5ul + w3);
+    Round(e, f, g, h, a, b, c, d, 0x3956c25bul + w4);
+    Round(d, e, f, g, h, a, b, c, 0x59f111f1ul + w5);
+    Round(c, d, e, f, g, h, a, b, 0x923f82a4ul + w6);
+    Round(b, c, d, e, f, g, h, a, 0xab1c5ed5ul + w7);
+    Round(a, b, c, d, e, f, g, h, 0x5807aa98ul);
+    Round(h, a, b, c, d, e, f, g, 0x12835b01ul);
+    Round(g, h, a, b, c, d, e, f, 0x243185beul);
+    Round(f, g, h, a, b, c, d, e, 0x550c7dc3ul);
+    Round(e, f, g, h, a, b, c, d, 0x72be5d74ul);
+    Round(d, e, f, g, h, a, b, c, 0x80deb1feul);
+    Round(c, d, e, f, g, h, a, b, 0x9bdc06a7ul);
+    Round(b, c, d, e, f, g, h, a, 0xc19bf274ul);
+    Round(a, b, c, d, e, f, g, h, 0xe49b69c1ul + (w0 += sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, 0xefbe4786ul + (w1 += 0xa00000ul + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, 0x0fc19dc6ul + (w2 += sigma1(w0) + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, 0x240ca1ccul + (w3 += sigma1(w1) + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, 0x2de92c6ful + (w4 += sigma1(w2) + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, 0x4a7484aaul + (w5 += sigma1(w3) + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, 0x5cb0a9dcul + (w6 += sigma1(w4) + 0x100ul + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, 0x76f988daul + (w7 += sigma1(w5) + w0 + 0x11002000ul));
+    Round(a, b, c, d, e, f, g, h, 0x983e5152ul + (w8 = 0x80000000ul + sigma1(w6) + w1));
+    Round(h, a, b, c, d, e, f, g, 0xa831c66dul + (w9 = sigma1(w7) + w2));
+    Round(g, h, a, b, c, d, e, f, 0xb00327c8ul + (w10 = sigma1(w8) + w3));
+    Round(f, g, h, a, b, c, d, e, 0xbf597fc7ul + (w11 = sigma1(w9) + w4));
+    Round(e, f, g, h, a, b, c, d, 0xc6e00bf3ul + (w12 = sigma1(w10) + w5));
+    Round(d, e, f, g, h, a, b, c, 0xd5a79147ul + (w13 = sigma1(w11) + w6));
+    Round(c, d, e, f, g, h, a, b, 0x06ca6351ul + (w14 = sigma1(w12) + w7 + 0x400022ul));
+    Round(b, c, d, e, f, g, h, a, 0x14292967ul + (w15 = 0x100ul + sigma1(w13) + w8 + sigma0(w0)));
+    Round(a, b, c, d, e, f, g, h, 0x27b70a85ul + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, 0x2e1b2138ul + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, 0x4d2c6dfcul + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, 0x53380d13ul + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, 0x650a7354ul + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, 0x766a0abbul + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, 0x81c2c92eul + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, 0x92722c85ul + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, 0xa2bfe8a1ul + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, 0xa81a664bul + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, 0xc24b8b70ul + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, 0xc76c51a3ul + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, 0xd192e819ul + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, 0xd6990624ul + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, 0xf40e3585ul + (w14 += sigma1(w12) + w7 + sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, 0x106aa070ul + (w15 += sigma1(w13) + w8 + sigma0(w0)));
+    Round(a, b, c, d, e, f, g, h, 0x19a4c116ul + (w0 += sigma1(w14) + w9 + sigma0(w1)));
+    Round(h, a, b, c, d, e, f, g, 0x1e376c08ul + (w1 += sigma1(w15) + w10 + sigma0(w2)));
+    Round(g, h, a, b, c, d, e, f, 0x2748774cul + (w2 += sigma1(w0) + w11 + sigma0(w3)));
+    Round(f, g, h, a, b, c, d, e, 0x34b0bcb5ul + (w3 += sigma1(w1) + w12 + sigma0(w4)));
+    Round(e, f, g, h, a, b, c, d, 0x391c0cb3ul + (w4 += sigma1(w2) + w13 + sigma0(w5)));
+    Round(d, e, f, g, h, a, b, c, 0x4ed8aa4aul + (w5 += sigma1(w3) + w14 + sigma0(w6)));
+    Round(c, d, e, f, g, h, a, b, 0x5b9cca4ful + (w6 += sigma1(w4) + w15 + sigma0(w7)));
+    Round(b, c, d, e, f, g, h, a, 0x682e6ff3ul + (w7 += sigma1(w5) + w0 + sigma0(w8)));
+    Round(a, b, c, d, e, f, g, h, 0x748f82eeul + (w8 += sigma1(w6) + w1 + sigma0(w9)));
+    Round(h, a, b, c, d, e, f, g, 0x78a5636ful + (w9 += sigma1(w7) + w2 + sigma0(w10)));
+    Round(g, h, a, b, c, d, e, f, 0x84c87814ul + (w10 += sigma1(w8) + w3 + sigma0(w11)));
+    Round(f, g, h, a, b, c, d, e, 0x8cc70208ul + (w11 += sigma1(w9) + w4 + sigma0(w12)));
+    Round(e, f, g, h, a, b, c, d, 0x90befffaul + (w12 += sigma1(w10) + w5 + sigma0(w13)));
+    Round(d, e, f, g, h, a, b, c, 0xa4506cebul + (w13 += sigma1(w11) + w6 + sigma0(w14)));
+    Round(c, d, e, f, g, h, a, b, 0xbef9a3f7ul + (w14 + sigma1(w12) + w7 + sigma0(w15)));
+    Round(b, c, d, e, f, g, h, a, 0xc67178f2ul + (w15 + sigma1(w13) + w8 + sigma0(w0)));
+
+    WriteBE32(out + 0, a + 0x6a09e667ul);
+    WriteBE32(out + 4, b + 0xbb67ae85ul);
+    WriteBE32(out + 8, c + 0x3c6ef372ul);
+    WriteBE32(out + 12, d + 0xa54ff53aul);
+    WriteBE32(out + 16, e + 0x510e527ful);
+    WriteBE32(out + 20, f + 0x9b05688cul);
+    WriteBE32(out + 24, g + 0x1f83d9abul);
+    WriteBE32(out + 28, h + 0x5be0cd19ul);
+}
+
+/** SHA-256 round constants, for the lane-parallel transforms below. */
+const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul
+};
+
+/** SHA-256 of one 32-byte message per lane, for N lanes stored lane-interleaved.
+ *  Every statement is a loop over the lanes so the compiler can keep each
+ *  variable in a vector register.
+ */
+template<int N>
+void Transform32Lanes(uint32_t* words, size_t stride)
+{
+    uint32_t w[16][N];
+    uint32_t a[N], b[N], c[N], d[N], e[N], f[N], g[N], h[N];
+
+    for (int i = 0; i < 8; i++)
+        for (int l = 0; l < N; l++)
+            w[i][l] = ReadBE32((const unsigned char*)&words[i * stride + l]);
+    for (int l = 0; l < N; l++) {
+        w[8][l] = 0x80000000ul;
+        w[9][l] = w[10][l] = w[11][l] = w[12][l] = w[13][l] = w[14][l] = 0;
+        w[15][l] = 256;
+        a[l] = 0x6a09e667ul;
+        b[l] = 0xbb67ae85ul;
+        c[l] = 0x3c6ef372ul;
+        d[l] = 0xa54ff53aul;
+        e[l] = 0x510e527ful;
+        f[l] = 0x9b05688cul;
+        g[l] = 0x1f83d9abul;
+        h[l] = 0x5be0cd19ul;
+    }
+
+    for (int t = 0; t < 64; t++) {
+        uint32_t* x = w[t & 15];
+        if (t >= 16)
+            for (int l = 0; l < N; l++)
+                x[l] += sigma1(w[(t - 2) & 15][l]) + w[(t - 7) & 15][l] + sigma0(w[(t - 15) & 15][l]);
+        for (int l = 0; l < N; l++) {
+            uint32_t t1 = h[l] + Sigma1(e[l]) + Ch(e[l], f[l], g[l]) + K[t] + x[l];
+            uint32_t t2 = Sigma0(a[l]) + Maj(a[l], b[l], c[l]);
+            h[l] = g[l];
+            g[l] = f[l];
+            f[l] = e[l];
+            e[l] = d[l] + t1;
+            d[l] = c[l];
+            c[l] = b[l];
+            b[l] = a[l];
+            a[l] = t1 + t2;
+        }
+    }
+
+    for (int l = 0; l < N; l++) {
+        WriteBE32((unsigned char*)&words[0 * stride + l], a[l] + 0x6a09e667ul);
+        WriteBE32((unsigned char*)&words[1 * stride + l], b[l] + 0xbb67ae85ul);
+        WriteBE32((unsigned char*)&words[2 * stride + l], c[l] + 0x3c6ef372ul);
+        WriteBE32((unsigned char*)&words[3 * stride + l], d[l] + 0xa54ff53aul);
+        WriteBE32((unsigned char*)&words[4 * stride + l], e[l] + 0x510e527ful);
+        WriteBE32((unsigned char*)&words[5 * stride + l], f[l] + 0x9b05688cul);
+        WriteBE32((unsigned char*)&words[6 * stride + l], g[l] + 0x1f83d9abul);
+        WriteBE32((unsigned char*)&words[7 * stride + l], h[l] + 0x5be0cd19ul);
+    }
+}
+
 } // namespace sha256
 
 typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
@@ -463,6 +646,32 @@ TransformD64Type TransformD64_2way = nullptr;
 TransformD64Type TransformD64_4way = nullptr;
 TransformD64Type TransformD64_8way = nullptr;
 
+typedef void (*Transform32Type)(unsigned char*, const unsigned char*);
+typedef void (*Transform32LanesType)(uint32_t*, size_t);
+Transform32Type Transform32 = sha256::Transform32;
+Transform32LanesType Transform32_4way = sha256::Transform32Lanes<4>;
+Transform32LanesType Transform32_8way = sha256::Transform32Lanes<8>;
+
+#if defined(ENABLE_SHANI)
+/** Lane-interleaved 32-byte hashing on top of the two-message SHA-NI transform. */
+template<int N>
+void Transform32LanesShani(uint32_t* words, size_t stride)
+{
+    uint32_t msg[16];
+    for (int l = 0; l < N; l += 2) {
+        for (int i = 0; i < 8; i++) {
+            msg[i] = words[i * stride + l];
+            msg[8 + i] = words[i * stride + l + 1];
+        }
+        sha256_shani::Transform32_2way((unsigned char*)msg, (const unsigned char*)msg);
+        for (int i = 0; i < 8; i++) {
+            words[i * stride + l] = msg[i];
+            words[i * stride + l + 1] = msg[8 + i];
+        }
+    }
+}
+#endif
+
 bool SelfTest() {
     // Input state (equal to the initial SHA256 state)
     static const uint32_t init[8] = {
@@ -545,10 +754,29 @@ bool SelfTest() {
         if (!std::equal(out, out + 256, result_d64)) return false;
     }
 
+    // Test the 32-byte transforms against the generic path, single and lane-interleaved.
+    for (int l = 0; l < 8; l++) {
+        unsigned char expect[32], out[32];
+        uint32_t lanes[8][8];
+        CSHA256().Write(data + 1 + 32 * l, 32).Finalize(expect);
+        Transform32(out, data + 1 + 32 * l);
+        if (!std::equal(out, out + 32, expect)) return false;
+
+        for (int k = 0; k < 8; k++)
+            for (int i = 0; i < 8; i++)
+                memcpy(&lanes[i][k], data + 1 + 32 * k + 4 * i, 4);
+        if (l < 4)
+            Transform32_4way(&lanes[0][0], 8);
+        else
+            Transform32_8way(&lanes[0][0], 8);
+        for (int i = 0; i < 8; i++)
+            if (memcmp(&lanes[i][l], expect + 4 * i, 4)) return false;
+    }
+
     return true;
 }
 
-#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#if defined(HAVE_GETCPUID)
 /** Check whether the OS has enabled AVX registers. */
 bool AVXEnabled()
 {
@@ -560,10 +788,19 @@ bool AVXEnabled()
 } // namespace
 
 
-std::string SHA256AutoDetect()
+std::string SHA256AutoDetect(const std::string& force)
 {
     std::string ret = "standard";
-#if defined(USE_ASM) && defined(HAVE_GETCPUID)
+    Transform = sha256::Transform;
+    TransformD64 = sha256::TransformD64;
+    TransformD64_2way = nullptr;
+    TransformD64_4way = nullptr;
+    TransformD64_8way = nullptr;
+    Transform32 = sha256::Transform32;
+    Transform32_4way = sha256::Transform32Lanes<4>;
+    Transform32_8way = sha256::Transform32Lanes<8>;
+
+#if defined(HAVE_GETCPUID)
     bool have_sse4 = false;
     bool have_xsave = false;
     bool have_avx = false;
@@ -593,11 +830,22 @@ std::string SHA256AutoDetect()
         have_shani = (ebx >> 29) & 1;
     }
 
+    // A forced backend only caps the choice, anything the CPU lacks still falls back
+    if (force == "standard")
+        have_sse4 = false;
+    if (force == "standard" || force == "sse41")
+        have_avx2 = false;
+    if (force == "standard" || force == "sse41" || force == "avx2")
+        have_shani = false;
+
 #if defined(ENABLE_SHANI) && !defined(BUILD_BITCOIN_INTERNAL)
     if (have_shani) {
         Transform = sha256_shani::Transform;
         TransformD64 = TransformD64Wrapper<sha256_shani::Transform>;
         TransformD64_2way = sha256d64_shani::Transform_2way;
+        Transform32 = sha256_shani::Transform32;
+        Transform32_4way = Transform32LanesShani<4>;
+        Transform32_8way = Transform32LanesShani<8>;
         ret = "shani(1way,2way)";
         have_sse4 = false; // Disable SSE4/AVX2;
         have_avx2 = false;
@@ -605,20 +853,22 @@ std::string SHA256AutoDetect()
 #endif
 
     if (have_sse4) {
-#if defined(__x86_64__) || defined(__amd64__)
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
         Transform = sha256_sse4::Transform;
         TransformD64 = TransformD64Wrapper<sha256_sse4::Transform>;
         ret = "sse4(1way)";
 #endif
 #if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
         TransformD64_4way = sha256d64_sse41::Transform_4way;
-        ret += ",sse41(4way)";
+        Transform32_4way = sha256_sse41::Transform32_4way;
+        ret = (ret == "standard") ? "sse41(4way)" : ret + ",sse41(4way)";
 #endif
     }
 
 #if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
     if (have_avx2 && have_avx && enabled_avx) {
         TransformD64_8way = sha256d64_avx2::Transform_8way;
+        Transform32_8way = sha256_avx2::Transform32_8way;
         ret += ",avx2(8way)";
     }
 #endif
@@ -731,3 +981,36 @@ void sha256d(unsigned char* hash, const unsigned char* data, int len) {
     ctx.Reset();
 }
 
+void SHA256_32(unsigned char* out, const unsigned char* in)
+{
+    Transform32(out, in);
+}
+
+void SHA256_32_4way(uint32_t* words, size_t stride)
+{
+    Transform32_4way(words, stride);
+}
+
+void SHA256_32_8way(uint32_t* words, size_t stride)
+{
+    Transform32_8way(words, stride);
+}
+
+void SHA256_80_Midstate(uint32_t* midstate, const unsigned char* header)
+{
+    sha256::Initialize(midstate);
+    Transform(midstate, header, 1);
+}
+
+void SHA256_80_Tail(unsigned char* out, const uint32_t* midstate, const unsigned char* tail)
+{
+    uint32_t s[8];
+    unsigned char block[64] = {0};
+    memcpy(block, tail, 16);
+    block[16] = 0x80;
+    WriteBE64(block + 56, 80 << 3);
+    memcpy(s, midstate, 32);
+    Transform(s, block, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
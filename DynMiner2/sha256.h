@@ -27,9 +27,10 @@ public:
 };
 
 /** Autodetect the best available SHA256 implementation.
+ *  force ("standard", "sse41", "avx2" or "shani") caps the choice at that backend.
  *  Returns the name of the implementation.
  */
-std::string SHA256AutoDetect();
+std::string SHA256AutoDetect(const std::string& force = "");
 
 /** Compute multiple double-SHA256's of 64-byte blobs.
  *  output:  pointer to a blocks*32 byte output buffer
@@ -40,4 +41,22 @@ void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks)
 
 void sha256d(unsigned char* hash, const unsigned char* data, int len);
 
+/** Compute the SHA-256 of a single 32-byte message. out and in may overlap. */
+void SHA256_32(unsigned char* out, const unsigned char* in);
+
+/** Compute the SHA-256 of a 32-byte message for 4 (or 8) independent lanes, in place.
+ *  words:  lane-interleaved messages, word i of lane l at words[i * stride + l],
+ *          each word holding four message bytes in memory order. The digests
+ *          are written back in the same layout.
+ *  stride: distance in words between consecutive words of one lane.
+ */
+void SHA256_32_4way(uint32_t* words, size_t stride);
+void SHA256_32_8way(uint32_t* words, size_t stride);
+
+/** SHA-256 state after the first 64 bytes of an 80-byte block header. */
+void SHA256_80_Midstate(uint32_t* midstate, const unsigned char* header);
+
+/** Finish the SHA-256 of an 80-byte header from its midstate and its last 16 bytes. */
+void SHA256_80_Tail(unsigned char* out, const uint32_t* midstate, const unsigned char* tail);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -0,0 +1,342 @@
+// make check - runs random hash programs through every CPU engine (legacy, threaded, jit, lane and
+// pipelined) on the original and the optimized bytecode, and compares each hash with a plain
+// interpreter that only knows the original opcodes.  Exits non zero on the first mismatches.
+
+#include "cMiner.h"
+#include "cGetWork.h"
+#include "cProgramVM.h"
+#include "cThreadedVM.h"
+#include "cProgramJIT.h"
+#include "cLaneVM.h"
+#include "cProgramOptimizer.h"
+#include "cHashBlock.h"
+#include "memgen_rows.h"
+#include "sha256.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+
+#define CHECK_PROGRAMS 200
+#define CHECK_NONCES 4				//consecutive nonces per program, one group of lanes
+
+
+static void sha(const unsigned char* data, size_t len, uint32_t* out) {
+	CSHA256 sha256;
+	sha256.Write(data, len);
+	sha256.Finalize((unsigned char*)out);
+}
+
+//The hash program as the miner first ran it, one opcode at a time
+static void referenceProgram(const unsigned char* header, const vector<uint32_t>& byteCode, uint32_t* hash, const unsigned char* hashBlock) {
+
+	static uint32_t memGen[512 * 8];
+	uint32_t tempStore[8] = {};
+	uint32_t prevHashSHA[8];
+	sha(header + 4, 32, prevHashSHA);
+	sha(header, 80, hash);
+
+	uint32_t pc = 0;
+	uint32_t memSize = 0;
+	uint32_t loopCount = 0;
+	uint32_t loopStart = 0;
+
+	while (true) {
+		uint32_t sum = 0;
+		switch (byteCode[pc]) {
+		case HASHOP_ADD:
+			for (int j = 0; j < 8; j++)
+				hash[j] += byteCode[pc + 1 + j];
+			pc += 9;
+			break;
+		case HASHOP_XOR:
+			for (int j = 0; j < 8; j++)
+				hash[j] ^= byteCode[pc + 1 + j];
+			pc += 9;
+			break;
+		case HASHOP_SHA_SINGLE:
+			sha((unsigned char*)hash, 32, hash);
+			pc++;
+			break;
+		case HASHOP_SHA_LOOP:
+			for (uint32_t i = 0; i < byteCode[pc + 1]; i++)
+				sha((unsigned char*)hash, 32, hash);
+			pc += 2;
+			break;
+		case HASHOP_MEMGEN:
+			memSize = byteCode[pc + 1];
+			for (uint32_t i = 0; i < memSize; i++) {
+				sha((unsigned char*)hash, 32, hash);
+				memcpy(&memGen[i * 8], hash, 32);
+			}
+			pc += 2;
+			break;
+		case HASHOP_MEMADD:
+		case HASHOP_MEMXOR:
+			for (uint32_t i = 0; i < memSize; i++)
+				for (int j = 0; j < 8; j++)
+					if (byteCode[pc] == HASHOP_MEMADD)
+						memGen[i * 8 + j] += byteCode[pc + 1 + j];
+					else
+						memGen[i * 8 + j] ^= byteCode[pc + 1 + j];
+			pc += 9;
+			break;
+		case HASHOP_MEMADDHASHPREV:
+			for (uint32_t i = 0; i < memSize; i++)
+				for (int j = 0; j < 8; j++)
+					memGen[i * 8 + j] += hash[j] + prevHashSHA[j];
+			pc++;
+			break;
+		case HASHOP_MEMXORHASHPREV:
+			for (uint32_t i = 0; i < memSize; i++)
+				for (int j = 0; j < 8; j++)
+					memGen[i * 8 + j] = (memGen[i * 8 + j] + hash[j]) ^ prevHashSHA[j];
+			pc++;
+			break;
+		case HASHOP_MEM_SELECT:
+			memcpy(hash, &memGen[(byteCode[pc + 1] % memSize) * 8], 32);
+			pc += 2;
+			break;
+		case HASHOP_READMEM2:
+			for (int j = 0; j < 8; j++)
+				hash[j] = (byteCode[pc + 1] == 0) ? (hash[j] ^ prevHashSHA[j]) : (byteCode[pc + 1] == 1) ? (hash[j] + prevHashSHA[j]) : hash[j];
+			for (int j = 0; j < 8; j++)
+				sum += hash[j];
+			memcpy(hash, &memGen[(sum % memSize) * 8], 32);
+			pc += 3;
+			break;
+		case HASHOP_LOOP:
+			for (int j = 0; j < 8; j++)
+				sum += hash[j];
+			loopCount = sum % byteCode[pc + 1] + 1;
+			pc += 2;
+			loopStart = pc;
+			break;
+		case HASHOP_ENDLOOP:
+			pc++;
+			if (--loopCount > 0)
+				pc = loopStart;
+			break;
+		case HASHOP_IF:
+			for (int j = 0; j < 8; j++)
+				sum += hash[j];
+			pc += 3 + ((sum % byteCode[pc + 1] == 0) ? byteCode[pc + 2] : 0);
+			break;
+		case HASHOP_STORETEMP:
+			memcpy(tempStore, hash, 32);
+			pc++;
+			break;
+		case HASHOP_EXECOP:
+			for (int j = 0; j < 8; j++)
+				sum += hash[j];
+			if (sum % 3 == 0)
+				for (int j = 0; j < 8; j++)
+					hash[j] += tempStore[j];
+			else if (sum % 3 == 1)
+				for (int j = 0; j < 8; j++)
+					hash[j] ^= tempStore[j];
+			else
+				sha((unsigned char*)hash, 32, hash);
+			pc += 2;
+			break;
+		case HASHOP_SUMBLOCK: {
+			uint64_t row = (hash[0] + hash[1] + hash[2] + hash[3]) % 3072;
+			uint64_t col = (hash[4] + hash[5] + hash[6] + hash[7]) % 32768;
+			for (int i = 0; i < 256; i++)
+				hash[i % 8] += hashBlock[row * 32768 + col + i];
+			pc++;
+			break;
+		}
+		case HASHOP_END:
+			return;
+		default:
+			printf("Reference interpreter: unknown opcode %u at %u\n", byteCode[pc], pc);
+			exit(1);
+		}
+	}
+}
+
+
+static string randomHex(mt19937& rng) {
+	char hex[65];
+	for (int i = 0; i < 64; i++)
+		hex[i] = "0123456789abcdef"[rng() % 16];
+	hex[64] = 0;
+	return hex;
+}
+
+//Every opcode the program source has, in the places a real program puts them: MEMGEN before the
+//memgen ops, IF with one line to skip, one LOOP.  Runs of ADD/XOR/SHA2/MEMADD/MEMXOR give the
+//optimizer something to fold.
+static string randomLine(mt19937& rng, bool haveMem) {
+	switch (rng() % (haveMem ? 14 : 6)) {
+	case 0: return "ADD " + randomHex(rng);
+	case 1: return "XOR " + randomHex(rng);
+	case 2: return "ADD " + string(64, '0');
+	case 3: return "SHA2";
+	case 4: return "SHA2 " + to_string(rng() % 6);
+	case 5: return "STORETEMP";
+	case 6: return "MEMADD " + randomHex(rng);
+	case 7: return "MEMXOR " + randomHex(rng);
+	case 8: return "MEMADDHASHPREV";
+	case 9: return "MEMXORHASHPREV";
+	case 10: return (rng() % 2) ? "READMEM MERKLE" : "READMEM HASHPREV";
+	case 11: return (rng() % 2) ? "READMEM2 XOR HASHPREV" : "READMEM2 ADD HASHPREV";
+	case 12: return "EXECOP TEMP";
+	default: return "SUMBLOCK";
+	}
+}
+
+//The lines generateBytecode can skip after an IF
+static string randomIfBody(mt19937& rng) {
+	switch (rng() % 9) {
+	case 0: return "ADD " + randomHex(rng);
+	case 1: return "XOR " + randomHex(rng);
+	case 2: return "SHA2 " + to_string(rng() % 4);
+	case 3: return "STORETEMP";
+	case 4: return "SUMBLOCK";
+	case 5: return "MEMADDHASHPREV";
+	case 6: return "MEMXORHASHPREV";
+	case 7: return "READMEM2 XOR HASHPREV";
+	default: return "MEMGEN SHA2 " + to_string(1 + rng() % 512);
+	}
+}
+
+static vector<string> randomProgram(mt19937& rng) {
+
+	vector<string> program;
+	program.push_back("STORETEMP");
+	for (int i = rng() % 4; i > 0; i--)
+		program.push_back(randomLine(rng, false));
+	program.push_back("MEMGEN SHA2 " + to_string(1 + ((rng() % 3 == 0) ? 511 : rng() % 512)));
+
+	for (int i = 3 + rng() % 10; i > 0; i--) {
+		if (rng() % 5 == 0) {
+			program.push_back("IF " + to_string(1 + rng() % 5));
+			program.push_back(randomIfBody(rng));
+		}
+		else
+			program.push_back(randomLine(rng, true));
+	}
+
+	program.push_back("LOOP " + to_string(1 + rng() % 6));
+	for (int i = 2 + rng() % 6; i > 0; i--)
+		program.push_back(randomLine(rng, true));
+	program.push_back("ENDLOOP");
+	if (rng() % 2)
+		program.push_back("SUMBLOCK");
+	program.push_back("SHA2");
+	program.push_back("ENDPROGRAM");
+	return program;
+}
+
+
+static void prepare(cPreparedJob& job, const unsigned char* header, const vector<uint32_t>& byteCode) {
+	memcpy(job.header, header, 80);
+	job.byteCode = byteCode;
+	cThreadedVM::decode(job.byteCode, job.threadedCode);
+	job.jitProgram = cProgramJIT::compile(job.byteCode);
+	SHA256_80_Midstate(job.midstate, header);
+	sha(header + 4, 32, job.prevHashSHA);
+}
+
+
+int main(int argc, char* argv[]) {
+
+	int programs = (argc > 1) ? atoi(argv[1]) : CHECK_PROGRAMS;
+
+	string sha256Impl = SHA256AutoDetect();
+	string memgenImpl = MemRowsAutoDetect();
+	cProgramJIT::inlineShani = (sha256Impl.find("shani") == 0);
+
+	//the rows SUMBLOCK reads get content, a zero block would hide a wrong row
+	unsigned char* hashBlock = (unsigned char*)calloc(HASHBLOCK_SIZE, 1);
+	if (hashBlock == NULL) {
+		printf("Unable to allocate the hash block\n");
+		return 1;
+	}
+	for (uint64_t i = 0; i < SUMBLOCK_SPAN; i++)
+		hashBlock[i] = (unsigned char)((i * 2654435761u) >> 13);
+
+	mt19937 rng(11);
+	cMiner legacy;
+	cMinerScratch* scratch = new cMinerScratch();
+	cPipelineSlot* pipeline = new cPipelineSlot[CHECK_NONCES];
+	cLaneVM laneVM(CHECK_NONCES);
+	int mismatches = 0;
+	int jitPrograms = 0;
+	size_t words = 0;
+	size_t optimizedWords = 0;
+
+	int p = 0;
+	for (; (p < programs) && (mismatches < 10); p++) {
+		unsigned char merkleRoot[32], prevHash[32], header[80];
+		for (int i = 0; i < 32; i++) {
+			merkleRoot[i] = rng();
+			prevHash[i] = rng();
+		}
+		for (int i = 0; i < 80; i++)
+			header[i] = rng();
+		uint32_t firstNonce = rng();
+
+		cProgramVM vm;
+		vm.generateBytecode(randomProgram(rng), merkleRoot, prevHash);
+		vector<uint32_t> optimized = cProgramOptimizer::optimize(vm.byteCode);
+		words += vm.byteCode.size();
+		optimizedWords += optimized.size();
+
+		uint32_t expected[CHECK_NONCES][8];
+		for (int n = 0; n < CHECK_NONCES; n++) {
+			unsigned char nonceHeader[80];
+			memcpy(nonceHeader, header, 80);
+			uint32_t nonce = firstNonce + n;
+			memcpy(nonceHeader + 76, &nonce, 4);
+			referenceProgram(nonceHeader, vm.byteCode, expected[n], hashBlock);
+		}
+
+		for (int o = 0; o < 2; o++) {
+			const char* form = (o == 0) ? "original" : "optimized";
+			cPreparedJob job;
+			prepare(job, header, (o == 0) ? vm.byteCode : optimized);
+			if (job.jitProgram)
+				jitPrograms++;
+
+			uint32_t hashes[5][CHECK_NONCES][8];
+			const char* engines[5] = { "legacy", "threaded", "jit", "lane", "pipelined" };
+			laneVM.runProgram(&job, firstNonce, &hashes[3][0][0], hashBlock);
+			for (int n = 0; n < CHECK_NONCES; n++) {
+				legacy.runProgram(&job, firstNonce + n, hashes[0][n], scratch, hashBlock);
+				cThreadedVM::runProgram(&job, firstNonce + n, hashes[1][n], scratch, hashBlock);
+				if (job.jitProgram)
+					job.jitProgram->runProgram(&job, firstNonce + n, hashes[2][n], scratch, hashBlock);
+				else
+					memcpy(hashes[2][n], expected[n], 32);
+				pipeline[n].nonce = firstNonce + n;
+				cThreadedVM::begin(&job, pipeline[n].nonce, pipeline[n].hash, &pipeline[n].scratch, &pipeline[n].resume);
+			}
+
+			//round robin, the way the pipelined engine interleaves its nonces at each SUMBLOCK
+			bool done[CHECK_NONCES] = {};
+			for (int left = CHECK_NONCES; left > 0; )
+				for (int n = 0; n < CHECK_NONCES; n++)
+					if (!done[n] && cThreadedVM::run(&job, pipeline[n].hash, &pipeline[n].scratch, &pipeline[n].resume, hashBlock)) {
+						memcpy(hashes[4][n], pipeline[n].hash, 32);
+						done[n] = true;
+						left--;
+					}
+
+			for (int e = 0; e < 5; e++)
+				for (int n = 0; n < CHECK_NONCES; n++)
+					if (memcmp(hashes[e][n], expected[n], 32) != 0) {
+						mismatches++;
+						printf("Program %d, %s bytecode, nonce %u: %s engine differs from the reference\n", p, form, firstNonce + n, engines[e]);
+					}
+		}
+	}
+
+	printf("Engine check: %d programs (%zu -> %zu words optimized, %d jit compiled), %d nonces each, SHA-256 %s, memgen %s - %s\n",
+		p, words, optimizedWords, jitPrograms, CHECK_NONCES, sha256Impl.c_str(), memgenImpl.c_str(),
+		(mismatches == 0) ? "all engines match" : "FAILED");
+	return (mismatches == 0) ? 0 : 1;
+}